@@ -25,6 +25,7 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -82,10 +83,42 @@ void adv_report_cb(struct adv_report *report)
 
 }
 
+void conn_evt_cb(const struct ll_conn_evt *evt)
+{
+	uint8_t data[LL_DATA_MTU_PAYLOAD];
+	uint8_t llid;
+	int16_t len;
+
+	switch (evt->type) {
+	case LL_CONN_EVT_CONNECTED:
+		DBG("connected to %s, handle %u, interval %u",
+					format_address(evt->peer.addr),
+					evt->handle, evt->interval);
+		break;
+
+	case LL_CONN_EVT_DISCONNECTED:
+		DBG("disconnected, handle %u, reason %02x", evt->handle,
+								evt->reason);
+		break;
+
+	case LL_CONN_EVT_DATA:
+		while ((len = ll_conn_recv(evt->handle, &llid, data)) > 0)
+			DBG("handle %u, LLID %u, %d octets received",
+						evt->handle, llid, len);
+		break;
+
+	case LL_CONN_EVT_UPDATED:
+		DBG("handle %u, interval %u, latency %u", evt->handle,
+					evt->interval, evt->latency);
+		break;
+	}
+}
+
 int main(void)
 {
 	log_init();
 	ll_init(&addr);
+	ll_set_conn_evt_cb(conn_evt_cb);
 
 	DBG("End init");
 
@@ -25,6 +25,7 @@
  */
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -70,6 +71,8 @@ static __inline const char *format_data(const uint8_t *data, uint8_t len)
 void adv_report_cb(struct adv_report *report)
 {
 	DBG("adv type %02x, addr type %02x", report->type, report->addr.type);
+	DBG("ch %u, rssi %d dBm, at %u us", report->channel, report->rssi,
+							report->timestamp);
 	DBG("address %s, data %s", format_address(report->addr.addr),
 					format_data(report->data, report->len));
 }
@@ -42,6 +42,17 @@
 #define BCI_ADV_CH_ALL			(BCI_ADV_CH_37 | BCI_ADV_CH_38	\
  							| BCI_ADV_CH_39)
 
+/* Adaptive advertising interval schedule */
+#define BCI_ADV_SCHED_STEPS_MAX		4
+#define BCI_ADV_SCHED_BOOST_SCAN_REQ	(1 << 0) /* Restart on scan request */
+
+/* HCI Funcional Specification Section 7.8.5, Core 4.1 page 1248 */
+#define BCI_ADV_FILTER_NONE		0x00	/* Requests from any device */
+#define BCI_ADV_FILTER_SCAN		0x01	/* Scan requests: white list */
+#define BCI_ADV_FILTER_CONN		0x02	/* Conn. requests: white list */
+#define BCI_ADV_FILTER_BOTH		(BCI_ADV_FILTER_SCAN		\
+							| BCI_ADV_FILTER_CONN)
+
 /* HCI Funcional Specification Section 7.8.5, Core 4.1 page 1247 */
 typedef enum bci_adv {
 	BCI_ADV_CONN_UNDIR,	/* connectable undirected */
@@ -53,8 +64,19 @@ typedef enum bci_adv {
 
 struct bci_adv_params {
 	bci_adv_t type;
-	uint32_t interval;
+	uint32_t interval;		/* ignored for BCI_ADV_CONN_DIR_HIGH */
 	uint8_t chmap;
+	bdaddr_t direct_addr;		/* peer address for directed types */
+	uint8_t filter_policy;		/* BCI_ADV_FILTER_* */
+};
+
+/* When a schedule is set, the interval of the advertising parameters is
+ * ignored: each step's interval is used for the step's duration (in us, 0 for
+ * forever) and the last step lasts forever.
+ */
+struct bci_adv_sched_step {
+	uint32_t interval;
+	uint32_t duration;
 };
 
 /*
@@ -81,6 +103,13 @@ int16_t bci_set_advertising_params(const struct bci_adv_params *params);
 int16_t bci_set_advertising_data(const uint8_t *data, uint8_t len);
 int16_t bci_set_scan_response_data(const uint8_t *data, uint8_t len);
 int16_t bci_set_advertise_enable(uint8_t enable);
+int16_t bci_set_advertising_schedule(const struct bci_adv_sched_step *steps,
+						uint8_t nsteps, uint8_t flags);
+int16_t bci_advertise_boost(void);
+
+int16_t bci_white_list_add(const bdaddr_t *addr);
+int16_t bci_white_list_remove(const bdaddr_t *addr);
+int16_t bci_white_list_clear(void);
 
 int8_t bci_ad_put(uint8_t *buffer, bci_ad_t type, ...);
 bool bci_ad_get(const uint8_t *buffer, uint8_t len, bci_ad_t type, ...);
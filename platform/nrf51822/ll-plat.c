@@ -24,6 +24,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <nrf51.h>
 
@@ -33,23 +34,13 @@
 #include "ll.h"
 #include "nrf51822.h"
 
-static adv_report_cb_t adv_report_cb = NULL;
-static struct adv_report *adv_report = NULL;
-
 void SWI0_IRQHandler(void)
 {
-	if (adv_report_cb)
-		adv_report_cb(adv_report);
+	ll_adv_reports_deliver();
 }
 
-int16_t ll_plat_send_adv_report(adv_report_cb_t cb, struct adv_report *rpt)
+int16_t ll_plat_signal_adv_reports(void)
 {
-	if (!cb || !rpt)
-		return -EINVAL;
-
-	adv_report_cb = cb;
-	adv_report = rpt;
-
 	NVIC_SetPendingIRQ(SWI0_IRQn);
 
 	return 0;
@@ -33,6 +33,7 @@
 #include <blessed/errcodes.h>
 
 #include "radio.h"
+#include "timer.h"
 #include "nrf51822.h"
 
 #define MAX_BUF_LEN			RADIO_MAX_PDU
@@ -47,17 +48,108 @@
 	(RADIO_SHORTS_READY_START_Enabled				\
 		<< RADIO_SHORTS_READY_START_Pos)			\
 	| (RADIO_SHORTS_END_DISABLE_Enabled				\
-		<< RADIO_SHORTS_END_DISABLE_Pos)
+		<< RADIO_SHORTS_END_DISABLE_Pos)				\
+	| (RADIO_SHORTS_ADDRESS_RSSISTART_Enabled			\
+		<< RADIO_SHORTS_ADDRESS_RSSISTART_Pos)			\
+	| (RADIO_SHORTS_DISABLED_RSSISTOP_Enabled			\
+		<< RADIO_SHORTS_DISABLED_RSSISTOP_Pos)
 
-static uint8_t inbuf[MAX_BUF_LEN] __attribute__ ((aligned));
+/* Link Layer specification Section 4.1, Core 4.1 page 2524
+ *
+ * Time between the end of a transmission and the reception of the Access
+ * Address of the reply: T_IFS (150 us) plus preamble and Access Address
+ * (40 us). A margin is added for the T_IFS tolerance (+/- 2 us) and for the
+ * radio timings.
+ */
+#define RX_TIMEOUT_TIFS			(150 + 40 + 16)
+
+/* TIMER1 is dedicated to the radio, running at 1 MHz */
+#define RX_TIMER_PRESCALER		4
+#define RX_WINDOW_MAX			0xFFFF		/* 16-bit timer */
+
+/* PPI channels used to stop the reception by hardware when nothing is received
+ * after T_IFS. The timer is started at the end of the transmission and is
+ * stopped if an Access Address is received. Otherwise, the radio is disabled
+ * when it expires.
+ */
+#define PPI_CH_RX_TIMEOUT_START		0	/* RADIO END -> TIMER1 START */
+#define PPI_CH_RX_TIMEOUT_CANCEL	1	/* RADIO ADDRESS -> TIMER1 STOP */
+#define PPI_CH_RX_TIMEOUT_EXPIRE	2	/* TIMER1 CC0 -> RADIO DISABLE */
+
+#define PPI_RX_TIMEOUT_MSK		((1UL << PPI_CH_RX_TIMEOUT_START) |	\
+					(1UL << PPI_CH_RX_TIMEOUT_CANCEL) |	\
+					(1UL << PPI_CH_RX_TIMEOUT_EXPIRE))
+
+/* PPI channel used to drop packets from unknown devices by hardware */
+#define PPI_CH_DEV_MISS			3	/* RADIO DEVMISS -> RADIO DISABLE */
+
+/* PPI channels capturing the times of the packets into TIMER2, a 1 MHz counter
+ * running while the radio is used. They are converted to timestamps at the end
+ * of each packet, so they do not depend on the interrupt latency.
+ */
+#define PPI_CH_CAPTURE_ADDRESS		4	/* RADIO ADDRESS -> TIMER2 CC0 */
+#define PPI_CH_CAPTURE_END		5	/* RADIO END -> TIMER2 CC1 */
+
+#define PPI_CAPTURE_MSK			((1UL << PPI_CH_CAPTURE_ADDRESS) |	\
+					(1UL << PPI_CH_CAPTURE_END))
+
+#define CAPTURE_NOW			2	/* TIMER2 CC2 */
+
+/* Ring of RX buffers. Each reception goes to a free buffer, which is handed to
+ * the receive callback while the radio moves to the next free one. So the
+ * callback can restart the reception right away, and it can keep the buffer
+ * (see radio_hold_buf()) to pass the PDU to upper layers without a copy.
+ */
+#ifndef CONFIG_RADIO_RX_BUFS
+#define CONFIG_RADIO_RX_BUFS		8
+#endif
+
+/* Buffers are kept word aligned for the EasyDMA */
+#define RX_BUF_LEN			((MAX_BUF_LEN + 3) & ~3)
+
+static uint8_t rx_bufs[CONFIG_RADIO_RX_BUFS][RX_BUF_LEN]
+						__attribute__ ((aligned));
+static volatile bool rx_held[CONFIG_RADIO_RX_BUFS];
+static uint8_t rx_idx;			/* Buffer of the next reception */
+
+/* Buffer being handed to the receive callback, if it can be held */
+static const uint8_t *rx_cb_buf;
 static uint8_t *outbuf;
 
 static radio_recv_cb_t recv_cb;
 static radio_send_cb_t send_cb;
+static radio_timeout_cb_t timeout_cb;
 
 static volatile uint8_t status;
 static volatile uint32_t flags;
 
+/* Receive window of the next radio_recv() (see radio_set_rx_window()) */
+static uint32_t rx_window;
+
+/* Device address match status of the last received packet */
+static bool dev_matched;
+
+/* RSSI of the last received packet, sampled after its Access Address */
+static int8_t rssi;
+
+/* Timestamps of the Access Address and of the end of the last packet */
+static uint32_t address_time;
+static uint32_t end_time;
+
+/* Channel of the current (ch) and of the last received packet (rx_ch) */
+static uint8_t ch;
+static uint8_t rx_ch;
+
+/* Channel switch during a reception (see radio_switch_channel()). If it can not
+ * be done right away, it is deferred to the next radio_recv(). The dead time
+ * is measured from the switch until the radio is ready again. */
+static volatile bool switch_pending;
+static uint8_t switch_ch;
+static int8_t switch_freq;
+static uint32_t switch_start;
+static uint32_t switch_cnt;
+static uint32_t switch_dead_time;
+
 static __inline int8_t ch2freq(uint8_t ch)
 {
 	/* nRF51 Series Reference Manual v2.1, section 16.2.19, page 91
@@ -83,35 +175,253 @@ static __inline int8_t ch2freq(uint8_t ch)
 	}
 }
 
+static __inline void rx_timeout_arm(void)
+{
+	NRF_TIMER1->TASKS_STOP = 1UL;
+	NRF_TIMER1->TASKS_CLEAR = 1UL;
+	NRF_TIMER1->EVENTS_COMPARE[0] = 0UL;
+	NRF_TIMER1->CC[0] = RX_TIMEOUT_TIFS;
+
+	NRF_PPI->CHENSET = PPI_RX_TIMEOUT_MSK;
+}
+
+/* Same as the RX timeout, but the timer is started right away */
+static __inline void rx_window_arm(uint32_t us)
+{
+	NRF_TIMER1->TASKS_STOP = 1UL;
+	NRF_TIMER1->TASKS_CLEAR = 1UL;
+	NRF_TIMER1->EVENTS_COMPARE[0] = 0UL;
+	NRF_TIMER1->CC[0] = us;
+
+	NRF_PPI->CHENSET = (1UL << PPI_CH_RX_TIMEOUT_CANCEL)
+					| (1UL << PPI_CH_RX_TIMEOUT_EXPIRE);
+	NRF_TIMER1->TASKS_START = 1UL;
+}
+
+static __inline void rx_timeout_disarm(void)
+{
+	NRF_PPI->CHENCLR = PPI_RX_TIMEOUT_MSK;
+
+	NRF_TIMER1->TASKS_STOP = 1UL;
+	NRF_TIMER1->TASKS_CLEAR = 1UL;
+	NRF_TIMER1->EVENTS_COMPARE[0] = 0UL;
+	NVIC_ClearPendingIRQ(TIMER1_IRQn);
+}
+
+/* A packet dropped by the PPI never gets an END event: the DISABLED event
+ * tells when it happens (see RADIO_IRQHandler()) */
+static __inline void set_dev_miss_ppi(uint32_t f)
+{
+	if (f & RADIO_FLAGS_DEV_MATCH) {
+		NRF_RADIO->EVENTS_DISABLED = 0UL;
+		NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
+		NRF_PPI->CHENSET = 1UL << PPI_CH_DEV_MISS;
+	} else {
+		NRF_PPI->CHENCLR = 1UL << PPI_CH_DEV_MISS;
+		NRF_RADIO->INTENCLR = RADIO_INTENCLR_DISABLED_Msk;
+	}
+}
+
+/* TIMER2 and the timestamps have the same 1 MHz clock: the captures are taken
+ * back from the current timestamp. The 16-bit counter is enough, since this
+ * runs right after the END event. */
+static __inline void capture_times(void)
+{
+	uint32_t now;
+	uint16_t ticks;
+
+	NRF_TIMER2->TASKS_CAPTURE[CAPTURE_NOW] = 1UL;
+	now = timer_get_timestamp();
+	ticks = NRF_TIMER2->CC[CAPTURE_NOW];
+
+	address_time = now - (uint16_t) (ticks - NRF_TIMER2->CC[0]);
+	end_time = now - (uint16_t) (ticks - NRF_TIMER2->CC[1]);
+}
+
+/* Move the radio to the next free buffer of the ring, and return the buffer of
+ * the last reception. If every other buffer is held, the radio stays in the
+ * same buffer.
+ */
+static __inline uint8_t rx_buf_rotate(void)
+{
+	uint8_t idx = rx_idx;
+	uint8_t next = rx_idx;
+
+	for (uint8_t i = 1; i < CONFIG_RADIO_RX_BUFS; i++) {
+		next = (next + 1 == CONFIG_RADIO_RX_BUFS) ? 0 : next + 1;
+
+		if (!rx_held[next]) {
+			rx_idx = next;
+			break;
+		}
+	}
+
+	return idx;
+}
+
+/* The radio was disabled by the PPI because nothing was received, or because
+ * the packet came from an unknown device */
+static void rx_abort(void)
+{
+	rx_timeout_disarm();
+
+	flags = 0;
+	NRF_RADIO->SHORTS = BASE_SHORTS;
+	NRF_RADIO->INTENCLR = RADIO_INTENCLR_ADDRESS_Msk
+					| RADIO_INTENCLR_DEVMATCH_Msk;
+	status &= ~STATUS_BUSY;
+
+	if (timeout_cb)
+		timeout_cb();
+}
+
+void TIMER1_IRQHandler(void)
+{
+	rx_abort();
+}
+
+/* Shorts of a reception waiting for a packet, as set by radio_recv() */
+static __inline uint32_t rx_shorts(void)
+{
+	if ((flags & RADIO_FLAGS_TX_NEXT) && !(flags & RADIO_FLAGS_DEV_MATCH))
+		return BASE_SHORTS | RADIO_SHORTS_DISABLED_TXEN_Msk;
+
+	return BASE_SHORTS;
+}
+
+/* Used from the next radio ramp-up */
+static __inline void set_channel(uint8_t c, int8_t freq)
+{
+	ch = c;
+	NRF_RADIO->DATAWHITEIV = c & 0x3F;
+	NRF_RADIO->FREQUENCY = freq;
+}
+
+/* A packet is being received after a transmission (and it comes from a known
+ * device, if RADIO_FLAGS_DEV_MATCH is set): only now it is safe to chain the
+ * next transmission. A disable caused by the RX timeout or by a device address
+ * mismatch must not trigger it.
+ */
+static __inline void chain_tx(void)
+{
+	NRF_RADIO->INTENCLR = RADIO_INTENCLR_ADDRESS_Msk
+					| RADIO_INTENCLR_DEVMATCH_Msk;
+
+	if ((status & STATUS_RX) && (flags & RADIO_FLAGS_TX_NEXT))
+		NRF_RADIO->SHORTS |= RADIO_SHORTS_DISABLED_TXEN_Msk;
+}
+
 void RADIO_IRQHandler(void)
 {
+	uint32_t inten = NRF_RADIO->INTENSET;
 	uint8_t old_status;
+	uint8_t idx;
 	bool active;
 
+	if ((inten & RADIO_INTENSET_ADDRESS_Msk) && NRF_RADIO->EVENTS_ADDRESS) {
+		NRF_RADIO->EVENTS_ADDRESS = 0UL;
+		chain_tx();
+	}
+
+	/* EVENTS_DEVMATCH is cleared only at the end of the reception */
+	if ((inten & RADIO_INTENSET_DEVMATCH_Msk) && NRF_RADIO->EVENTS_DEVMATCH)
+		chain_tx();
+
+	/* Restarted on the new channel after a switch */
+	if ((inten & RADIO_INTENSET_READY_Msk) && NRF_RADIO->EVENTS_READY) {
+		NRF_RADIO->EVENTS_READY = 0UL;
+		NRF_RADIO->INTENCLR = RADIO_INTENCLR_READY_Msk;
+		NRF_RADIO->SHORTS = rx_shorts();
+
+		switch_dead_time += timer_get_timestamp() - switch_start;
+		switch_cnt++;
+	}
+
+	/* Disabled by the PPI on a device address mismatch: the reception
+	 * ends without an END event (the ADDRESS event already stopped the
+	 * RX timeout). EVENTS_DEVMISS is cleared at the end of the other
+	 * receptions. */
+	if ((inten & RADIO_INTENSET_DISABLED_Msk)
+					&& NRF_RADIO->EVENTS_DISABLED) {
+		NRF_RADIO->EVENTS_DISABLED = 0UL;
+
+		if (NRF_RADIO->EVENTS_END == 0UL && NRF_RADIO->EVENTS_DEVMISS
+						&& (status & STATUS_RX)) {
+			NRF_RADIO->EVENTS_DEVMISS = 0UL;
+			NRF_PPI->CHENCLR = 1UL << PPI_CH_DEV_MISS;
+			NRF_RADIO->INTENCLR = RADIO_INTENCLR_DISABLED_Msk;
+			rx_abort();
+			return;
+		}
+	}
+
+	if (NRF_RADIO->EVENTS_END == 0UL)
+		return;
+
 	NRF_RADIO->EVENTS_END = 0UL;
 
+	capture_times();
+
 	active = false;
 	old_status = status;
 	status = STATUS_INITIALIZED;
 
 	if (old_status & STATUS_RX) {
+		rx_timeout_disarm();
+
+		rx_ch = ch;
+		dev_matched = NRF_RADIO->EVENTS_DEVMATCH;
+		rssi = -(int8_t) (NRF_RADIO->RSSISAMPLE
+					& RADIO_RSSISAMPLE_RSSISAMPLE_Msk);
+		NRF_RADIO->EVENTS_DEVMATCH = 0UL;
+		NRF_RADIO->EVENTS_DEVMISS = 0UL;
+
 		if (flags & RADIO_FLAGS_TX_NEXT) {
 			flags &= ~RADIO_FLAGS_TX_NEXT;
 			status |= STATUS_TX;
 			active = true;
 			NRF_RADIO->PACKETPTR = (uint32_t) outbuf;
 			NRF_RADIO->SHORTS &= ~RADIO_SHORTS_DISABLED_TXEN_Msk;
+
+			/* RX -> TX -> RX: listen for the reply, the timeout
+			 * timer is started at the end of the transmission */
+			if (flags & RADIO_FLAGS_RX_NEXT) {
+				NRF_RADIO->SHORTS |=
+					RADIO_SHORTS_DISABLED_RXEN_Msk;
+				rx_timeout_arm();
+			}
 		}
 
+		idx = rx_buf_rotate();
+		rx_cb_buf = (idx != rx_idx) ? rx_bufs[idx] : NULL;
+
 		if (recv_cb)
-			recv_cb(inbuf, NRF_RADIO->CRCSTATUS, active);
+			recv_cb(rx_bufs[idx], NRF_RADIO->CRCSTATUS, active);
+
+		rx_cb_buf = NULL;
 	} else if (old_status & STATUS_TX) {
 		if (flags & RADIO_FLAGS_RX_NEXT) {
 			flags &= ~RADIO_FLAGS_RX_NEXT;
 			status |= STATUS_RX;
 			active = true;
-			NRF_RADIO->PACKETPTR = (uint32_t) inbuf;
+			NRF_RADIO->PACKETPTR = (uint32_t) rx_bufs[rx_idx];
 			NRF_RADIO->SHORTS &= ~RADIO_SHORTS_DISABLED_RXEN_Msk;
+
+			/* The RX timeout timer is already running, the end
+			 * of the reception must not restart it */
+			NRF_PPI->CHENCLR = 1UL << PPI_CH_RX_TIMEOUT_START;
+
+			/* Events of the transmission must not be taken as
+			 * events of the reception */
+			NRF_RADIO->EVENTS_ADDRESS = 0UL;
+			NRF_RADIO->EVENTS_DEVMATCH = 0UL;
+			NRF_RADIO->EVENTS_DEVMISS = 0UL;
+
+			if (flags & RADIO_FLAGS_TX_NEXT)
+				NRF_RADIO->INTENSET =
+					(flags & RADIO_FLAGS_DEV_MATCH) ?
+					RADIO_INTENSET_DEVMATCH_Msk :
+					RADIO_INTENSET_ADDRESS_Msk;
 		}
 
 		if (send_cb)
@@ -127,7 +437,14 @@ int16_t radio_set_callbacks(radio_recv_cb_t rcb, radio_send_cb_t scb)
 	return 0;
 }
 
-int16_t radio_prepare(uint8_t ch, uint32_t aa, uint32_t crcinit)
+int16_t radio_set_timeout_cb(radio_timeout_cb_t tcb)
+{
+	timeout_cb = tcb;
+
+	return 0;
+}
+
+int16_t radio_prepare(uint8_t c, uint32_t aa, uint32_t crcinit)
 {
 	int8_t freq;
 
@@ -137,13 +454,13 @@ int16_t radio_prepare(uint8_t ch, uint32_t aa, uint32_t crcinit)
 	if (status & STATUS_BUSY)
 		return -EBUSY;
 
-	freq = ch2freq(ch);
+	freq = ch2freq(c);
 
 	if (freq < 0)
 		return -EINVAL;
 
-	NRF_RADIO->DATAWHITEIV = ch & 0x3F;
-	NRF_RADIO->FREQUENCY = freq;
+	switch_pending = false;
+	set_channel(c, freq);
 	NRF_RADIO->BASE0 = (aa << 8) & 0xFFFFFF00;
 	NRF_RADIO->PREFIX0 = (aa >> 24) & RADIO_PREFIX0_AP0_Msk;
 	NRF_RADIO->CRCINIT = crcinit;
@@ -156,8 +473,14 @@ int16_t radio_send(const uint8_t *data, uint32_t f)
 	status |= STATUS_TX;
 	flags |= f;
 
-	if (f & RADIO_FLAGS_RX_NEXT)
+	NRF_TIMER2->TASKS_START = 1UL;
+
+	if (f & RADIO_FLAGS_RX_NEXT) {
 		NRF_RADIO->SHORTS |= RADIO_SHORTS_DISABLED_RXEN_Msk;
+		rx_timeout_arm();
+	}
+
+	set_dev_miss_ppi(f);
 
 	NRF_RADIO->PACKETPTR = (uint32_t) data;
 	NRF_RADIO->TASKS_TXEN = 1UL;
@@ -170,12 +493,63 @@ int16_t radio_recv(uint32_t f)
 	status |= STATUS_RX;
 	flags |= f;
 
-	if (f & RADIO_FLAGS_TX_NEXT)
-		NRF_RADIO->SHORTS |= RADIO_SHORTS_DISABLED_TXEN_Msk;
+	NRF_TIMER2->TASKS_START = 1UL;
 
-	NRF_RADIO->PACKETPTR = (uint32_t) inbuf;
+	NRF_RADIO->EVENTS_ADDRESS = 0UL;
+	NRF_RADIO->EVENTS_DEVMATCH = 0UL;
+	NRF_RADIO->EVENTS_DEVMISS = 0UL;
+	set_dev_miss_ppi(f);
+
+	if (switch_pending) {
+		switch_pending = false;
+		set_channel(switch_ch, switch_freq);
+	}
+
+	/* The end of the receive window disables the radio too: then, the
+	 * transmission is only chained once a packet is being received */
+	if (f & RADIO_FLAGS_TX_NEXT) {
+		if (f & RADIO_FLAGS_DEV_MATCH) {
+			NRF_RADIO->INTENSET = RADIO_INTENSET_DEVMATCH_Msk;
+		} else if (rx_window) {
+			NRF_RADIO->INTENSET = RADIO_INTENSET_ADDRESS_Msk;
+		} else {
+			NRF_RADIO->SHORTS |= RADIO_SHORTS_DISABLED_TXEN_Msk;
+		}
+	}
+
+	NRF_RADIO->PACKETPTR = (uint32_t) rx_bufs[rx_idx];
 	NRF_RADIO->TASKS_RXEN = 1UL;
 
+	if (rx_window) {
+		rx_window_arm(rx_window);
+		rx_window = 0;
+	}
+
+	return 0;
+}
+
+int16_t radio_set_next(uint32_t f)
+{
+	if (!(status & STATUS_TX))
+		return -ENOREADY;
+
+	flags |= f;
+
+	if (f & RADIO_FLAGS_RX_NEXT) {
+		NRF_RADIO->SHORTS |= RADIO_SHORTS_DISABLED_RXEN_Msk;
+		rx_timeout_arm();
+	}
+
+	return 0;
+}
+
+int16_t radio_set_rx_window(uint32_t us)
+{
+	if (us > RX_WINDOW_MAX)
+		return -EINVAL;
+
+	rx_window = us;
+
 	return 0;
 }
 
@@ -186,19 +560,175 @@ int16_t radio_stop(void)
 
 	flags = 0;
 	NRF_RADIO->SHORTS = BASE_SHORTS;
-
-	NRF_RADIO->EVENTS_DISABLED = 0UL;
-	NRF_RADIO->TASKS_DISABLE = 1UL;
-	while (NRF_RADIO->EVENTS_DISABLED == 0UL);
+	NRF_RADIO->INTENCLR = RADIO_INTENCLR_ADDRESS_Msk
+					| RADIO_INTENCLR_DEVMATCH_Msk
+					| RADIO_INTENCLR_READY_Msk;
+	NRF_PPI->CHENCLR = 1UL << PPI_CH_DEV_MISS;
+	NRF_RADIO->INTENCLR = RADIO_INTENCLR_DISABLED_Msk;
+	rx_timeout_disarm();
+	rx_window = 0;
+
+	/* The radio may have been already disabled by the PPI */
+	if (NRF_RADIO->STATE != RADIO_STATE_STATE_Disabled) {
+		NRF_RADIO->EVENTS_DISABLED = 0UL;
+		NRF_RADIO->TASKS_DISABLE = 1UL;
+		while (NRF_RADIO->EVENTS_DISABLED == 0UL);
+	}
 
 	status &= ~STATUS_BUSY;
+	NRF_TIMER2->TASKS_STOP = 1UL;
 
 	return 0;
 }
 
+/* The radio is disabled and enabled again on the new channel by hardware
+ * (DISABLED -> RXEN short), so the only dead time is the radio ramp-up. The
+ * reception keeps its flags and buffer.
+ */
+int16_t radio_switch_channel(uint8_t c)
+{
+	int8_t freq = ch2freq(c);
+
+	if (freq < 0)
+		return -EINVAL;
+
+	switch_ch = c;
+	switch_freq = freq;
+
+	/* Only a reception waiting for a packet is switched right away: not
+	 * during a packet, a transmission or a wait T_IFS after it */
+	if (!(status & STATUS_RX) || NRF_RADIO->EVENTS_ADDRESS
+				|| NRF_RADIO->EVENTS_END
+				|| (NRF_PPI->CHEN & PPI_RX_TIMEOUT_MSK)) {
+		switch_pending = true;
+		return 0;
+	}
+
+	switch_pending = false;
+	set_channel(c, freq);
+	switch_start = timer_get_timestamp();
+
+	NRF_RADIO->EVENTS_READY = 0UL;
+	NRF_RADIO->INTENSET = RADIO_INTENSET_READY_Msk;
+	NRF_RADIO->SHORTS = (NRF_RADIO->SHORTS
+					& ~RADIO_SHORTS_DISABLED_TXEN_Msk)
+					| RADIO_SHORTS_DISABLED_RXEN_Msk;
+	NRF_RADIO->TASKS_DISABLE = 1UL;
+
+	return 0;
+}
+
+void radio_get_switch_stats(uint32_t *switches, uint32_t *dead_time)
+{
+	*switches = switch_cnt;
+	*dead_time = switch_dead_time;
+}
+
+uint8_t radio_get_rx_channel(void)
+{
+	return rx_ch;
+}
+
+/* nRF51 Series Reference Manual v2.1, section 16.1.4
+ *
+ * PACKETPTR is double-buffered: it is read at the START task. A transmission
+ * chained after a reception starts after the radio ramp-up, so its buffer can
+ * still be changed from the receive callback.
+ */
 void radio_set_out_buffer(uint8_t *buf)
 {
 	outbuf = buf;
+
+	if (status & STATUS_TX)
+		NRF_RADIO->PACKETPTR = (uint32_t) buf;
+}
+
+/* nRF51 Series Reference Manual v2.1, section 16.1.13
+ *
+ * The device address match compares the first 48 bits of the payload (e.g.
+ * ScanA of SCAN_REQ or InitA of CONNECT_REQ) and the TxAdd bit of the header
+ * with the addresses in DAB/DAP.
+ */
+int16_t radio_set_dev_match(uint8_t idx, const uint8_t *addr, uint8_t type)
+{
+	uint32_t dacnf;
+
+	if (idx >= RADIO_DEV_MATCH_MAX || addr == NULL)
+		return -EINVAL;
+
+	NRF_RADIO->DAB[idx] = addr[0] | (addr[1] << 8) | (addr[2] << 16)
+						| ((uint32_t) addr[3] << 24);
+	NRF_RADIO->DAP[idx] = addr[4] | (addr[5] << 8);
+
+	dacnf = NRF_RADIO->DACNF | (1UL << (RADIO_DACNF_ENA0_Pos + idx));
+
+	if (type)
+		dacnf |= 1UL << (RADIO_DACNF_TXADD0_Pos + idx);
+	else
+		dacnf &= ~(1UL << (RADIO_DACNF_TXADD0_Pos + idx));
+
+	NRF_RADIO->DACNF = dacnf;
+
+	return 0;
+}
+
+int16_t radio_clear_dev_match(void)
+{
+	NRF_RADIO->DACNF = 0UL;
+
+	return 0;
+}
+
+bool radio_dev_matched(void)
+{
+	return dev_matched;
+}
+
+int8_t radio_get_rssi(void)
+{
+	return rssi;
+}
+
+uint32_t radio_get_address_time(void)
+{
+	return address_time;
+}
+
+uint32_t radio_get_end_time(void)
+{
+	return end_time;
+}
+
+/* Keep the buffer passed to the receive callback: it will not be used by the
+ * radio until released. Must be called from the receive callback.
+ */
+int16_t radio_hold_buf(const uint8_t *pdu)
+{
+	if (pdu == NULL || pdu != rx_cb_buf)
+		return rx_cb_buf ? -EINVAL : -ENOMEM;
+
+	rx_held[(pdu - rx_bufs[0]) / RX_BUF_LEN] = true;
+
+	return 0;
+}
+
+/* Give back a buffer kept with radio_hold_buf(). Any pointer inside the buffer
+ * is accepted.
+ */
+int16_t radio_release_buf(const uint8_t *ptr)
+{
+	uint32_t idx;
+
+	if (ptr < rx_bufs[0] || ptr >= rx_bufs[CONFIG_RADIO_RX_BUFS])
+		return -EINVAL;
+
+	idx = (ptr - rx_bufs[0]) / RX_BUF_LEN;
+	if (!rx_held[idx])
+		return -EALREADY;
+
+	rx_held[idx] = false;
+
+	return 0;
 }
 
 int16_t radio_set_tx_power(radio_power_t power)
@@ -337,12 +867,67 @@ int16_t radio_init(void)
 	NVIC_ClearPendingIRQ(RADIO_IRQn);
 	NVIC_EnableIRQ(RADIO_IRQn);
 
+	/* RX timeout timer: single shot of RX_TIMEOUT_TIFS us */
+	NRF_TIMER1->TASKS_STOP = 1UL;
+	NRF_TIMER1->MODE = TIMER_MODE_MODE_Timer;
+	NRF_TIMER1->BITMODE = TIMER_BITMODE_BITMODE_16Bit;
+	NRF_TIMER1->PRESCALER = RX_TIMER_PRESCALER;
+	NRF_TIMER1->CC[0] = RX_TIMEOUT_TIFS;
+	NRF_TIMER1->SHORTS = TIMER_SHORTS_COMPARE0_STOP_Msk;
+	NRF_TIMER1->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+
+	NRF_PPI->CHENCLR = PPI_RX_TIMEOUT_MSK;
+	NRF_PPI->CH[PPI_CH_RX_TIMEOUT_START].EEP =
+				(uint32_t) &NRF_RADIO->EVENTS_END;
+	NRF_PPI->CH[PPI_CH_RX_TIMEOUT_START].TEP =
+				(uint32_t) &NRF_TIMER1->TASKS_START;
+	NRF_PPI->CH[PPI_CH_RX_TIMEOUT_CANCEL].EEP =
+				(uint32_t) &NRF_RADIO->EVENTS_ADDRESS;
+	NRF_PPI->CH[PPI_CH_RX_TIMEOUT_CANCEL].TEP =
+				(uint32_t) &NRF_TIMER1->TASKS_STOP;
+	NRF_PPI->CH[PPI_CH_RX_TIMEOUT_EXPIRE].EEP =
+				(uint32_t) &NRF_TIMER1->EVENTS_COMPARE[0];
+	NRF_PPI->CH[PPI_CH_RX_TIMEOUT_EXPIRE].TEP =
+				(uint32_t) &NRF_RADIO->TASKS_DISABLE;
+
+	NRF_PPI->CHENCLR = 1UL << PPI_CH_DEV_MISS;
+	NRF_PPI->CH[PPI_CH_DEV_MISS].EEP =
+				(uint32_t) &NRF_RADIO->EVENTS_DEVMISS;
+	NRF_PPI->CH[PPI_CH_DEV_MISS].TEP =
+				(uint32_t) &NRF_RADIO->TASKS_DISABLE;
+
+	/* Packet times: 16-bit counter at 1 MHz, started with the radio */
+	NRF_TIMER2->TASKS_STOP = 1UL;
+	NRF_TIMER2->MODE = TIMER_MODE_MODE_Timer;
+	NRF_TIMER2->BITMODE = TIMER_BITMODE_BITMODE_16Bit;
+	NRF_TIMER2->PRESCALER = RX_TIMER_PRESCALER;
+
+	NRF_PPI->CH[PPI_CH_CAPTURE_ADDRESS].EEP =
+				(uint32_t) &NRF_RADIO->EVENTS_ADDRESS;
+	NRF_PPI->CH[PPI_CH_CAPTURE_ADDRESS].TEP =
+				(uint32_t) &NRF_TIMER2->TASKS_CAPTURE[0];
+	NRF_PPI->CH[PPI_CH_CAPTURE_END].EEP =
+				(uint32_t) &NRF_RADIO->EVENTS_END;
+	NRF_PPI->CH[PPI_CH_CAPTURE_END].TEP =
+				(uint32_t) &NRF_TIMER2->TASKS_CAPTURE[1];
+	NRF_PPI->CHENSET = PPI_CAPTURE_MSK;
+
+	radio_clear_dev_match();
+
+	NVIC_SetPriority(TIMER1_IRQn, IRQ_PRIORITY_HIGH);
+	NVIC_ClearPendingIRQ(TIMER1_IRQn);
+	NVIC_EnableIRQ(TIMER1_IRQn);
+
 	radio_set_callbacks(NULL, NULL);
+	radio_set_timeout_cb(NULL);
 	radio_set_tx_power(RADIO_POWER_0_DBM);
 	radio_set_out_buffer(NULL);
 
-	NRF_RADIO->PACKETPTR = (uint32_t) inbuf;
-	memset(inbuf, 0, sizeof(inbuf));
+	memset(rx_bufs, 0, sizeof(rx_bufs));
+	memset((void *) rx_held, 0, sizeof(rx_held));
+	rx_idx = 0;
+	rx_cb_buf = NULL;
+	NRF_RADIO->PACKETPTR = (uint32_t) rx_bufs[rx_idx];
 
 	status = STATUS_INITIALIZED;
 
@@ -61,6 +61,11 @@ struct timer {
 static struct timer timers[MAX_TIMERS];
 static uint8_t active = 0;
 
+/* Timestamps extend the 24-bit counter: ticks elapsed before the last counter
+ * wrap or clear, and the counter value at the last read to detect wraps. */
+static uint32_t ts_base = 0;
+static uint32_t ts_last = 0;
+
 static __inline uint32_t us2ticks(uint64_t us)
 {
 	return ROUNDED_DIV(us * HFCLK, TIMER_SECONDS(1)
@@ -92,6 +97,28 @@ static __inline uint32_t get_curr_ticks(void)
 	return ticks;
 }
 
+static __inline uint32_t update_timestamp(uint32_t curr)
+{
+	if (curr < ts_last)
+		ts_base += 0x1000000;
+
+	ts_last = curr;
+
+	return ts_base + curr;
+}
+
+/* The counter is cleared when the last timer is stopped */
+static __inline void stop_counter(void)
+{
+	update_timestamp(get_curr_ticks());
+
+	NRF_TIMER0->TASKS_STOP = 1UL;
+	NRF_TIMER0->TASKS_CLEAR = 1UL;
+
+	ts_base += ts_last;
+	ts_last = 0;
+}
+
 static __inline void update_cc(uint8_t id, uint32_t ticks)
 {
 	uint32_t clr_mask = 0;
@@ -109,6 +136,10 @@ void TIMER0_IRQHandler(void)
 	uint8_t id_mask = 0;
 	uint8_t id;
 
+	/* Repeated timers are shorter than the counter period: this keeps
+	 * track of its wraps while any timer is running. */
+	update_timestamp(curr);
+
 	for (id = 0; id < MAX_TIMERS; id++) {
 		if (NRF_TIMER0->EVENTS_COMPARE[id]) {
 			NRF_TIMER0->EVENTS_COMPARE[id] = 0UL;
@@ -126,16 +157,16 @@ void TIMER0_IRQHandler(void)
 			} else if (timers[id].type == TIMER_SINGLESHOT) {
 				timers[id].active = 0;
 				active--;
-
-				if (active == 0) {
-					NRF_TIMER0->TASKS_STOP = 1UL;
-					NRF_TIMER0->TASKS_CLEAR = 1UL;
-				}
 			}
 
 			timers[id].cb();
 		}
 	}
+
+	/* Only stopped after the callbacks: a timer started again from its
+	 * callback keeps the counter, and the timestamps, running */
+	if (active == 0)
+		stop_counter();
 }
 
 int16_t timer_init(void)
@@ -185,11 +216,8 @@ create:
 	return id;
 }
 
-int16_t timer_start(int16_t id, uint32_t us, timer_cb_t cb)
+static int16_t start(int16_t id, uint32_t curr, uint32_t ticks, timer_cb_t cb)
 {
-	uint32_t curr = get_curr_ticks();
-	uint32_t ticks;
-
 	if (id < 0)
 		return -EINVAL;
 
@@ -199,8 +227,6 @@ int16_t timer_start(int16_t id, uint32_t us, timer_cb_t cb)
 	if (timers[id].active)
 		return -EALREADY;
 
-	ticks = us2ticks(us);
-
 	if (ticks >= 0xFFFFFF)
 		return -EINVAL;
 
@@ -219,6 +245,27 @@ int16_t timer_start(int16_t id, uint32_t us, timer_cb_t cb)
 	return 0;
 }
 
+int16_t timer_start(int16_t id, uint32_t us, timer_cb_t cb)
+{
+	return start(id, get_curr_ticks(), us2ticks(us), cb);
+}
+
+/* Single shot expiring at a timestamp (see timer_get_timestamp()). Both are
+ * read from the same counter capture, so the expiry does not depend on when
+ * this function is called. Fails with -EINVAL if the timestamp is not in the
+ * future.
+ */
+int16_t timer_start_at(int16_t id, uint32_t timestamp, timer_cb_t cb)
+{
+	uint32_t curr = get_curr_ticks();
+	int32_t us = timestamp - ticks2us(update_timestamp(curr));
+
+	if (us <= 0)
+		return -EINVAL;
+
+	return start(id, curr, us2ticks(us), cb);
+}
+
 int16_t timer_stop(int16_t id)
 {
 	uint32_t clr_mask = 0;
@@ -236,10 +283,8 @@ int16_t timer_stop(int16_t id)
 	timers[id].active = 0;
 	active--;
 
-	if (active == 0) {
-		NRF_TIMER0->TASKS_STOP = 1UL;
-		NRF_TIMER0->TASKS_CLEAR = 1UL;
-	}
+	if (active == 0)
+		stop_counter();
 
 	return 0;
 }
@@ -259,3 +304,11 @@ uint32_t timer_get_remaining_us(int16_t id)
 
 	return ticks2us(ticks);
 }
+
+/* Monotonic time in us, wrapping every ~71 minutes. It only advances while a
+ * timer is active (e.g. while advertising or scanning).
+ */
+uint32_t timer_get_timestamp(void)
+{
+	return ticks2us(update_timestamp(get_curr_ticks()));
+}
@@ -49,13 +49,22 @@ STATIC_ASSERT(BCI_ADV_CH_37 == LL_ADV_CH_37);
 STATIC_ASSERT(BCI_ADV_CH_38 == LL_ADV_CH_38);
 STATIC_ASSERT(BCI_ADV_CH_39 == LL_ADV_CH_39);
 STATIC_ASSERT(BCI_ADV_CH_ALL == LL_ADV_CH_ALL);
+STATIC_ASSERT(BCI_ADV_SCHED_STEPS_MAX == LL_ADV_SCHED_STEPS_MAX);
+STATIC_ASSERT(BCI_ADV_SCHED_BOOST_SCAN_REQ == LL_ADV_SCHED_BOOST_SCAN_REQ);
+STATIC_ASSERT(sizeof(struct bci_adv_sched_step) ==
+					sizeof(struct ll_adv_sched_step));
+STATIC_ASSERT(BCI_ADV_FILTER_NONE == LL_ADV_FILTER_NONE);
+STATIC_ASSERT(BCI_ADV_FILTER_SCAN == LL_ADV_FILTER_SCAN);
+STATIC_ASSERT(BCI_ADV_FILTER_CONN == LL_ADV_FILTER_CONN);
+STATIC_ASSERT(BCI_ADV_FILTER_BOTH == LL_ADV_FILTER_BOTH);
 
 static const bdaddr_t *laddr;
 
 static struct bci_adv_params adv_params = {
 	.type = BCI_ADV_NONCONN_UNDIR,
 	.interval = BCI_ADV_INTERVAL_MIN_NONCONN,
-	.chmap = LL_ADV_CH_ALL
+	.chmap = LL_ADV_CH_ALL,
+	.filter_policy = BCI_ADV_FILTER_NONE
 };
 
 void bci_get_advertising_params(struct bci_adv_params *params)
@@ -71,6 +80,9 @@ int16_t bci_set_advertising_params(const struct bci_adv_params *params)
 	if (params->interval > BCI_ADV_INTERVAL_MAX)
 		return -EINVAL;
 
+	if (params->filter_policy & ~BCI_ADV_FILTER_BOTH)
+		return -EINVAL;
+
 	/* XXX: Should the lib return an error when the user uses a not yet
 	 * implemented type? If yes, fix the code below.
 	 */
@@ -89,6 +101,12 @@ int16_t bci_set_advertising_params(const struct bci_adv_params *params)
 		break;
 	}
 
+	if ((params->type == BCI_ADV_CONN_DIR_HIGH ||
+				params->type == BCI_ADV_CONN_DIR_LOW) &&
+			params->direct_addr.type != BDADDR_TYPE_PUBLIC &&
+			params->direct_addr.type != BDADDR_TYPE_RANDOM)
+		return -EINVAL;
+
 	memcpy(&adv_params, params, sizeof(adv_params));
 
 	return 0;
@@ -134,6 +152,7 @@ int16_t bci_set_advertise_enable(uint8_t enable)
 {
 	int16_t err;
 	ll_pdu_t type = LL_PDU_ADV_IND;
+	uint32_t interval = adv_params.interval;
 
 	if (!enable)
 		return ll_advertise_stop();
@@ -142,7 +161,47 @@ int16_t bci_set_advertise_enable(uint8_t enable)
 	if (err < 0)
 		return err;
 
-	return ll_advertise_start(type, adv_params.interval, adv_params.chmap);
+	if (type == LL_PDU_ADV_DIRECT_IND) {
+		err = ll_set_direct_address(&adv_params.direct_addr);
+		if (err < 0)
+			return err;
+	}
+
+	if (adv_params.type == BCI_ADV_CONN_DIR_HIGH)
+		interval = LL_ADV_INTERVAL_DIRECT_HIGH;
+
+	err = ll_set_adv_filter_policy(adv_params.filter_policy);
+	if (err < 0)
+		return err;
+
+	return ll_advertise_start(type, interval, adv_params.chmap);
+}
+
+int16_t bci_set_advertising_schedule(const struct bci_adv_sched_step *steps,
+						uint8_t nsteps, uint8_t flags)
+{
+	return ll_set_advertising_schedule(
+			(const struct ll_adv_sched_step *) steps, nsteps, flags);
+}
+
+int16_t bci_advertise_boost(void)
+{
+	return ll_advertise_boost();
+}
+
+int16_t bci_white_list_add(const bdaddr_t *addr)
+{
+	return ll_white_list_add(addr);
+}
+
+int16_t bci_white_list_remove(const bdaddr_t *addr)
+{
+	return ll_white_list_remove(addr);
+}
+
+int16_t bci_white_list_clear(void)
+{
+	return ll_white_list_clear();
 }
 
 int16_t bci_init(const bdaddr_t *addr)
@@ -0,0 +1,401 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <blessed/errcodes.h>
+#include <blessed/bdaddr.h>
+
+#include "ll.h"
+#include "ll-adv-table.h"
+#include "assert.h"
+
+/* Number of advertisers tracked. Must be a power of two, up to 16384 (the hash
+ * index has twice as many 16-bit slots). Each entry takes about 90 octets of
+ * RAM. */
+#ifndef CONFIG_LL_ADV_TABLE_SIZE
+#define CONFIG_LL_ADV_TABLE_SIZE	32
+#endif
+
+/* Summaries passed at once to the periodic summary callback */
+#ifndef CONFIG_LL_ADV_SUMMARY_BATCH
+#define CONFIG_LL_ADV_SUMMARY_BATCH	4
+#endif
+
+STATIC_ASSERT(CONFIG_LL_ADV_TABLE_SIZE >= 2 &&
+		CONFIG_LL_ADV_TABLE_SIZE <= 16384 &&
+		!(CONFIG_LL_ADV_TABLE_SIZE & (CONFIG_LL_ADV_TABLE_SIZE - 1)));
+
+/* The hash index is kept at most half full, so probe sequences are short and
+ * always end on a free slot */
+#define SLOTS				(2 * CONFIG_LL_ADV_TABLE_SIZE)
+#define SLOT(i)				((i) & (SLOTS - 1))
+#define NONE				0xFFFF
+#define CH_NONE				0xFF
+
+/* FNV-1a, 32 bits */
+#define FNV_OFFSET			2166136261UL
+#define FNV_PRIME			16777619UL
+
+/* Running averages weight: 1/2^AVG_SHIFT for the new sample */
+#define AVG_SHIFT			3
+
+/* Link Layer specification Section 1.4.1, Core 4.1 page 2502 */
+#define ADV_CH_FIRST			37
+#define ADV_CH_CNT			3
+
+struct adv_entry {
+	/* Incremented before and after each update (odd while updating), so
+	 * readers can detect that they were preempted by the radio */
+	volatile uint16_t seq;
+
+	uint16_t	hash;
+	uint16_t	prev;		/* LRU list, towards the head */
+	uint16_t	next;		/* LRU list, towards the tail */
+	uint8_t		last_ch;	/* of the last advertising PDU */
+	bool		used;
+	uint32_t	last_adv;	/* timestamp of the last adv. PDU */
+	int16_t		rssi[ADV_CH_CNT];	/* 1/16 dBm */
+
+	struct ll_adv_summary s;
+};
+
+static struct adv_entry entries[CONFIG_LL_ADV_TABLE_SIZE];
+static uint16_t entries_cnt;
+
+/* Hash index: entry of each slot, or NONE */
+static uint16_t slots[SLOTS];
+
+/* Most (head) and least (tail) recently seen advertisers */
+static uint16_t lru_head;
+static uint16_t lru_tail;
+
+static __inline uint16_t addr_hash(uint8_t type, const uint8_t *addr)
+{
+	uint32_t h = FNV_OFFSET;
+	uint8_t i;
+
+	for (i = 0; i < BDADDR_LEN; i++) {
+		h ^= addr[i];
+		h *= FNV_PRIME;
+	}
+
+	h ^= type;
+	h *= FNV_PRIME;
+
+	return (uint16_t) (h ^ (h >> 16));
+}
+
+static int32_t slot_find(uint8_t type, const uint8_t *addr, uint16_t hash)
+{
+	uint16_t pos = SLOT(hash);
+	struct adv_entry *e;
+
+	while (slots[pos] != NONE) {
+		e = &entries[slots[pos]];
+
+		if (e->hash == hash && e->s.addr.type == type
+				&& !memcmp(e->s.addr.addr, addr, BDADDR_LEN))
+			return pos;
+
+		pos = SLOT(pos + 1);
+	}
+
+	return -1;
+}
+
+static void slot_insert(uint16_t idx)
+{
+	uint16_t pos = SLOT(entries[idx].hash);
+
+	while (slots[pos] != NONE)
+		pos = SLOT(pos + 1);
+
+	slots[pos] = idx;
+}
+
+/* Linear probing deletion: the following entries of the probe sequence are
+ * shifted back, so no tombstones are needed */
+static void slot_remove(uint16_t pos)
+{
+	uint16_t next = pos;
+	uint16_t home;
+
+	for (;;) {
+		next = SLOT(next + 1);
+
+		if (slots[next] == NONE)
+			break;
+
+		home = SLOT(entries[slots[next]].hash);
+
+		/* The entry can stay if its home is cyclically in
+		 * (pos, next] */
+		if (pos <= next ? (pos < home && home <= next)
+					: (pos < home || home <= next))
+			continue;
+
+		slots[pos] = slots[next];
+		pos = next;
+	}
+
+	slots[pos] = NONE;
+}
+
+static void lru_unlink(uint16_t idx)
+{
+	struct adv_entry *e = &entries[idx];
+
+	if (e->prev != NONE)
+		entries[e->prev].next = e->next;
+	else
+		lru_head = e->next;
+
+	if (e->next != NONE)
+		entries[e->next].prev = e->prev;
+	else
+		lru_tail = e->prev;
+}
+
+static void lru_push(uint16_t idx)
+{
+	struct adv_entry *e = &entries[idx];
+
+	e->prev = NONE;
+	e->next = lru_head;
+
+	if (lru_head != NONE)
+		entries[lru_head].prev = idx;
+	else
+		lru_tail = idx;
+
+	lru_head = idx;
+}
+
+/* Estimate the advertising interval (advInterval + advDelay) from the time
+ * between two advertising PDUs received on the same channel, which may span
+ * several missed advertising events */
+static uint32_t interval_update(uint32_t est, uint32_t delta)
+{
+	uint32_t events;
+
+	if (est == 0 || delta < est / 2)
+		return delta;
+
+	events = (delta + est / 2) / est;
+
+	return est + (((int32_t) (delta / events - est)) >> AVG_SHIFT);
+}
+
+int16_t ll_adv_table_reset(void)
+{
+	uint16_t i;
+
+	memset(entries, 0, sizeof(entries));
+	for (i = 0; i < SLOTS; i++)
+		slots[i] = NONE;
+
+	entries_cnt = 0;
+	lru_head = NONE;
+	lru_tail = NONE;
+
+	return 0;
+}
+
+/* Aggregate a received PDU. Called from the radio interrupt. */
+void ll_adv_table_update(uint8_t pdu_type, uint8_t addr_type,
+			const uint8_t *addr, const uint8_t *data, uint8_t len,
+			int8_t rssi, uint8_t ch, uint32_t timestamp)
+{
+	uint16_t hash = addr_hash(addr_type, addr);
+	struct adv_entry *e;
+	int32_t pos;
+	uint16_t idx;
+	uint8_t i;
+	bool adv = (pdu_type != LL_PDU_SCAN_RSP);
+
+	pos = slot_find(addr_type, addr, hash);
+
+	if (pos >= 0) {
+		idx = slots[pos];
+		lru_unlink(idx);
+	} else if (entries_cnt < CONFIG_LL_ADV_TABLE_SIZE) {
+		idx = entries_cnt++;
+	} else {
+		/* Evict the least recently seen advertiser */
+		idx = lru_tail;
+		lru_unlink(idx);
+		slot_remove(slot_find(entries[idx].s.addr.type,
+				entries[idx].s.addr.addr, entries[idx].hash));
+	}
+
+	lru_push(idx);
+
+	e = &entries[idx];
+	e->seq++;
+	__sync_synchronize();
+
+	if (pos < 0) {
+		e->hash = hash;
+		e->used = true;
+		e->last_ch = CH_NONE;
+
+		for (i = 0; i < ADV_CH_CNT; i++)
+			e->s.rssi[i] = LL_RSSI_UNKNOWN;
+
+		e->s.addr.type = addr_type;
+		memcpy(e->s.addr.addr, addr, BDADDR_LEN);
+		e->s.count = 0;
+		e->s.first_seen = timestamp;
+		e->s.interval = 0;
+
+		slot_insert(idx);
+	}
+
+	if (adv) {
+		if (ch == e->last_ch)
+			e->s.interval = interval_update(e->s.interval,
+						timestamp - e->last_adv);
+
+		e->last_ch = ch;
+		e->last_adv = timestamp;
+	}
+
+	if (ch >= ADV_CH_FIRST && ch < ADV_CH_FIRST + ADV_CH_CNT) {
+		i = ch - ADV_CH_FIRST;
+
+		if (e->s.rssi[i] == LL_RSSI_UNKNOWN)
+			e->rssi[i] = rssi * 16;
+		else
+			e->rssi[i] += (rssi * 16 - e->rssi[i]) >> AVG_SHIFT;
+
+		e->s.rssi[i] = (int8_t) (e->rssi[i] / 16);
+	}
+
+	e->s.type = pdu_type;
+	e->s.len = len;
+	memcpy(e->s.data, data, len);
+	e->s.count++;
+	e->s.last_seen = timestamp;
+
+	__sync_synchronize();
+	e->seq++;
+}
+
+/* Consistent copy of an entry, even if preempted by the radio interrupt */
+static bool entry_read(uint16_t idx, struct ll_adv_summary *summary)
+{
+	struct adv_entry *e = &entries[idx];
+	uint16_t seq;
+
+	do {
+		seq = e->seq;
+		__sync_synchronize();
+
+		if (!e->used)
+			return false;
+
+		*summary = e->s;
+
+		__sync_synchronize();
+	} while ((seq & 1) || seq != e->seq);
+
+	return true;
+}
+
+/**@brief Read the advertisers aggregated while scanning
+ *
+ * Can be called while scanning. Iterate from *cursor = 0 until 0 is returned.
+ *
+ * @param [in,out] cursor: position in the table, updated for the next call
+ * @param [out] summaries: array of max summaries
+ * @param [in] max: size of the summaries array
+ *
+ * @return number of summaries read
+ */
+int16_t ll_adv_table_read(uint16_t *cursor, struct ll_adv_summary *summaries,
+								uint8_t max)
+{
+	int16_t n = 0;
+
+	if (cursor == NULL || summaries == NULL)
+		return -EINVAL;
+
+	while (n < max && *cursor < CONFIG_LL_ADV_TABLE_SIZE) {
+		if (entry_read(*cursor, &summaries[n]))
+			n++;
+
+		(*cursor)++;
+	}
+
+	return n;
+}
+
+/**@brief Read the aggregated information of an advertiser
+ *
+ * @return -EINVAL if the advertiser is not in the table
+ */
+int16_t ll_adv_table_find(const bdaddr_t *addr, struct ll_adv_summary *summary)
+{
+	uint16_t hash, pos, idx, n;
+
+	if (addr == NULL || summary == NULL)
+		return -EINVAL;
+
+	hash = addr_hash(addr->type, addr->addr);
+	pos = SLOT(hash);
+
+	/* A concurrent update may move the entries: only what was read is
+	 * checked, and the probe sequence is bounded */
+	for (n = 0; n < SLOTS; n++, pos = SLOT(pos + 1)) {
+		idx = ((volatile uint16_t *) slots)[pos];
+
+		if (idx == NONE)
+			break;
+
+		if (entries[idx].hash == hash && entry_read(idx, summary)
+				&& summary->addr.type == addr->type
+				&& !memcmp(summary->addr.addr, addr->addr,
+								BDADDR_LEN))
+			return 0;
+	}
+
+	return -EINVAL;
+}
+
+/* Deliver every summary to the application, in batches */
+void ll_adv_table_deliver(adv_summary_cb_t cb)
+{
+	struct ll_adv_summary batch[CONFIG_LL_ADV_SUMMARY_BATCH];
+	uint16_t cursor = 0;
+	int16_t n;
+
+	while ((n = ll_adv_table_read(&cursor, batch,
+					CONFIG_LL_ADV_SUMMARY_BATCH)) > 0)
+		cb(batch, n);
+}
@@ -0,0 +1,41 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+/* Per-advertiser aggregation table (SCANNING state)
+ *
+ * Instead of one report per received PDU, the PDUs of each advertiser are
+ * aggregated in a fixed capacity table: open addressing (linear probing) on a
+ * hash of the address, and the least recently seen advertiser is evicted when
+ * the table is full. The table is updated from the radio interrupt and read
+ * from lower priority contexts. Its capacity, CONFIG_LL_ADV_TABLE_SIZE, is up
+ * to 16384 advertisers, as far as the RAM allows.
+ */
+
+int16_t ll_adv_table_reset(void);
+void ll_adv_table_update(uint8_t pdu_type, uint8_t addr_type,
+			const uint8_t *addr, const uint8_t *data, uint8_t len,
+			int8_t rssi, uint8_t ch, uint32_t timestamp);
+void ll_adv_table_deliver(adv_summary_cb_t cb);
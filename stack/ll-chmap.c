@@ -0,0 +1,156 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <blessed/errcodes.h>
+#include <blessed/bdaddr.h>
+
+#include "ll.h"
+#include "ll-conn.h"
+#include "ll-chmap.h"
+
+/* A channel is bad when more than CONFIG_LL_CHMAP_PER % of its packets are
+ * lost, out of CONFIG_LL_CHMAP_SAMPLES packets at least */
+#ifndef CONFIG_LL_CHMAP_PER
+#define CONFIG_LL_CHMAP_PER		25
+#endif
+
+#ifndef CONFIG_LL_CHMAP_SAMPLES
+#define CONFIG_LL_CHMAP_SAMPLES		16
+#endif
+
+/* Channels kept at least in a filtered map, see ll_chmap_filter() */
+#ifndef CONFIG_LL_CHMAP_MIN
+#define CONFIG_LL_CHMAP_MIN		8
+#endif
+
+/* The counters are halved before they overflow */
+#define COUNT_MAX			0x8000
+
+static uint16_t ch_ok[LL_DATA_CH_NB];
+static uint16_t ch_lost[LL_DATA_CH_NB];
+static uint64_t ch_bad;
+static bool chmap_adaptive = true;
+
+static uint8_t ch_count(uint64_t mask)
+{
+	uint8_t n = 0;
+
+	for (; mask; mask &= mask - 1)
+		n++;
+
+	return n;
+}
+
+/**@brief Count a packet expected on a data channel
+ *
+ * @param [in] ch: the data channel
+ * @param [in] ok: the packet was received with a valid CRC
+ */
+void ll_chmap_count(uint8_t ch, bool ok)
+{
+	if (ch >= LL_DATA_CH_NB)
+		return;
+
+	if (ok)
+		ch_ok[ch]++;
+	else
+		ch_lost[ch]++;
+
+	if (ch_ok[ch] + ch_lost[ch] >= COUNT_MAX) {
+		ch_ok[ch] >>= 1;
+		ch_lost[ch] >>= 1;
+	}
+}
+
+/**@brief Classify the data channels from the packets counted so far
+ *
+ * The counters are halved, so the older packets weigh less.
+ */
+void ll_chmap_classify(void)
+{
+	uint64_t bad = 0;
+	uint32_t total;
+
+	for (uint8_t i = 0; i < LL_DATA_CH_NB; i++) {
+		total = ch_ok[i] + ch_lost[i];
+
+		if (total >= CONFIG_LL_CHMAP_SAMPLES
+				&& ch_lost[i] * 100UL
+					> total * CONFIG_LL_CHMAP_PER)
+			bad |= 1ULL << i;
+
+		ch_ok[i] >>= 1;
+		ch_lost[i] >>= 1;
+	}
+
+	ch_bad = bad;
+}
+
+/**@brief Leave the bad channels out of a channel map
+ *
+ * @param [in] mask: the channel map
+ *
+ * @return the channel map without the bad channels, or the channel map itself
+ * if less than CONFIG_LL_CHMAP_MIN of its channels would be left, or if the
+ * classification is disabled (see ll_set_data_ch_adaptive())
+ */
+uint64_t ll_chmap_filter(uint64_t mask)
+{
+	uint64_t good = mask & ~ch_bad;
+
+	if (!chmap_adaptive || ch_count(good) < CONFIG_LL_CHMAP_MIN)
+		return mask;
+
+	return good;
+}
+
+/**@brief Leave the bad data channels out of the connections
+ *
+ * The master connections move to the data channel map without the channels
+ * with a high packet error rate, see ll-chmap.h. When disabled, they move back
+ * to the map of ll_set_data_ch_map().
+ *
+ * @param [in] enable: true by default
+ */
+int16_t ll_set_data_ch_adaptive(bool enable)
+{
+	chmap_adaptive = enable;
+
+	return 0;
+}
+
+int16_t ll_chmap_init(void)
+{
+	memset(ch_ok, 0, sizeof(ch_ok));
+	memset(ch_lost, 0, sizeof(ch_lost));
+	ch_bad = 0;
+
+	return 0;
+}
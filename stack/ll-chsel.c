@@ -0,0 +1,191 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <blessed/errcodes.h>
+#include <blessed/bdaddr.h>
+
+#include "ll.h"
+#include "ll-conn.h"
+#include "ll-chsel.h"
+
+/* x / 37, for x < 2^16: the estimate is exact or one less */
+#define DIV37_MUL			1771
+
+static __inline uint8_t mod37(uint16_t x)
+{
+	uint32_t r = x - ((x * DIV37_MUL) >> 16) * LL_DATA_CH_NB;
+
+	return (r >= LL_DATA_CH_NB) ? r - LL_DATA_CH_NB : r;
+}
+
+/* Link Layer specification Section 4.5.8.2, Core 4.1 pages 2545-2546
+ * unmappedChannel = (lastUnmappedChannel + hopIncrement) mod 37, and the
+ * unused channels are remapped to used[unmappedChannel mod numUsedChannels].
+ */
+static void csa1_build(struct ll_chsel *cs)
+{
+	uint8_t remap[LL_DATA_CH_NB];
+	uint8_t unmapped = 0;
+	uint8_t i, j = 0;
+
+	for (i = 0; i < LL_DATA_CH_NB; i++) {
+		remap[i] = (cs->mask & (1ULL << i)) ? i : cs->used[j];
+
+		if (++j == cs->cnt)
+			j = 0;
+	}
+
+	for (i = 0; i < LL_DATA_CH_NB; i++) {
+		unmapped += cs->hop;
+		if (unmapped >= LL_DATA_CH_NB)
+			unmapped -= LL_DATA_CH_NB;
+
+		cs->seq[i] = remap[unmapped];
+	}
+}
+
+/* Bits of each octet in reverse order */
+static __inline uint16_t csa2_perm(uint16_t v)
+{
+	v = ((v & 0xF0F0) >> 4) | ((v & 0x0F0F) << 4);
+	v = ((v & 0xCCCC) >> 2) | ((v & 0x3333) << 2);
+	v = ((v & 0xAAAA) >> 1) | ((v & 0x5555) << 1);
+
+	return v;
+}
+
+/* Multiply, add and modulo 2^16 */
+static __inline uint16_t csa2_mam(uint16_t a, uint16_t b)
+{
+	return (a << 4) + a + b;
+}
+
+/* Core 5.0 Vol 6 Part B Section 4.5.8.3 */
+static uint8_t csa2_next(struct ll_chsel *cs, uint16_t counter)
+{
+	uint16_t prn = counter ^ cs->ch_id;
+	uint8_t unmapped;
+
+	for (uint8_t i = 0; i < 3; i++)
+		prn = csa2_mam(csa2_perm(prn), cs->ch_id);
+
+	prn ^= cs->ch_id;
+	unmapped = mod37(prn);
+
+	if (cs->mask & (1ULL << unmapped))
+		return unmapped;
+
+	/* remappingIndex = (N * prn_e) / 2^16 */
+	return cs->used[(cs->cnt * (uint32_t) prn) >> 16];
+}
+
+/**@brief Set the data channel map of a connection
+ *
+ * The events keep their position in the CSA #1 sequence. An invalid map leaves
+ * the channel selection unchanged.
+ *
+ * @param [in] cs: the channel selection of the connection
+ * @param [in] mask: the used data channels
+ *
+ * @return -EINVAL if less than two channels are used
+ */
+int16_t ll_chsel_set_map(struct ll_chsel *cs, uint64_t mask)
+{
+	uint8_t used[LL_DATA_CH_NB];
+	uint8_t cnt = 0;
+
+	mask &= LL_DATA_CH_ALL;
+
+	for (uint8_t i = 0; i < LL_DATA_CH_NB; i++) {
+		if (mask & (1ULL << i))
+			used[cnt++] = i;
+	}
+
+	/* Link Layer specification Section 2.3.3.1, Core 4.1 page 2510 */
+	if (cnt < 2)
+		return -EINVAL;
+
+	memcpy(cs->used, used, cnt);
+	cs->mask = mask;
+	cs->cnt = cnt;
+
+	if (cs->algo == LL_CHSEL_CSA1)
+		csa1_build(cs);
+
+	return 0;
+}
+
+/**@brief Set up the channel selection of a new connection
+ *
+ * @param [in] cs: the channel selection of the connection
+ * @param [in] algo: LL_CHSEL_CSA1 or LL_CHSEL_CSA2
+ * @param [in] mask: the used data channels
+ * @param [in] hop: hopIncrement (CSA #1 only)
+ * @param [in] aa: the connection Access Address (CSA #2 only)
+ *
+ * @return -EINVAL if algo or mask is invalid
+ */
+int16_t ll_chsel_init(struct ll_chsel *cs, uint8_t algo, uint64_t mask,
+						uint8_t hop, uint32_t aa)
+{
+	if (algo != LL_CHSEL_CSA1 && algo != LL_CHSEL_CSA2)
+		return -EINVAL;
+
+	cs->algo = algo;
+	cs->hop = hop;
+	cs->idx = 0;
+	cs->ch_id = (aa >> 16) ^ (aa & 0xFFFF);
+
+	return ll_chsel_set_map(cs, mask);
+}
+
+/**@brief Data channel of a connection event
+ *
+ * Must be called for every event, in order, from the event counter 0.
+ *
+ * @param [in] cs: the channel selection of the connection
+ * @param [in] counter: connEventCounter of the event
+ *
+ * @return the data channel
+ */
+uint8_t ll_chsel_next(struct ll_chsel *cs, uint16_t counter)
+{
+	uint8_t ch;
+
+	if (cs->algo == LL_CHSEL_CSA2)
+		return csa2_next(cs, counter);
+
+	ch = cs->seq[cs->idx];
+
+	if (++cs->idx == LL_DATA_CH_NB)
+		cs->idx = 0;
+
+	return ch;
+}
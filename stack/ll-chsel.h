@@ -0,0 +1,58 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+/* Data channel selection
+ *
+ * Link Layer specification Section 4.5.8, Core 4.1 pages 2544-2546 (Channel
+ * Selection Algorithm #1) and Core 5.0 Vol 6 Part B Section 4.5.8.3 (Channel
+ * Selection Algorithm #2). The channel of each connection event is computed
+ * without divisions: CSA #1 repeats every 37 events, so its channels are
+ * precomputed when the channel map is set, and CSA #2 only uses bit operations
+ * and multiplications.
+ */
+
+#define LL_CHSEL_CSA1			1
+#define LL_CHSEL_CSA2			2
+
+struct ll_chsel {
+	uint64_t	mask;
+	uint8_t		used[LL_DATA_CH_NB];	/* used channels, ascending */
+	uint8_t		cnt;
+	uint8_t		algo;			/* LL_CHSEL_CSA* */
+
+	/* CSA #1: channel of each event, from the event counter 0 */
+	uint8_t		hop;
+	uint8_t		seq[LL_DATA_CH_NB];
+	uint8_t		idx;			/* event counter modulo 37 */
+
+	/* CSA #2 */
+	uint16_t	ch_id;			/* channelIdentifier */
+};
+
+int16_t ll_chsel_init(struct ll_chsel *cs, uint8_t algo, uint64_t mask,
+						uint8_t hop, uint32_t aa);
+int16_t ll_chsel_set_map(struct ll_chsel *cs, uint64_t mask);
+uint8_t ll_chsel_next(struct ll_chsel *cs, uint16_t counter);
@@ -0,0 +1,1644 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include <blessed/errcodes.h>
+#include <blessed/log.h>
+#include <blessed/bdaddr.h>
+
+#include "radio.h"
+#include "timer.h"
+#include "ll.h"
+#include "ll-conn.h"
+#include "ll-chsel.h"
+#include "ll-chmap.h"
+#include "ll-pool.h"
+#include "assert.h"
+
+/* Link Layer specification Section 4.5.1, Core 4.1 pages 2538-2539
+ * connInterval, transmitWindowOffset and transmitWindowSize are multiples of
+ * 1.25 ms, connSupervisionTimeout is a multiple of 10 ms. The transmit window
+ * starts transmitWindowDelay (1.25 ms) after the end of the CONNECT_REQ PDU.
+ */
+#define T_CONN_UNIT			1250
+#define T_CONN_TIMEOUT_UNIT		10000
+#define T_CONN_WINDOW_DELAY		1250
+
+/* Link Layer specification Section 4.5.2, Core 4.1 page 2540
+ * A connection not established within 6 connection intervals is lost */
+#define CONN_ESTABLISH_INTERVALS	6
+
+/* Link Layer specification Section 2.3.3.1, Core 4.1 page 2510
+ * connSupervisionTimeout must also be longer than
+ * (1 + connSlaveLatency) * connInterval * 2, and transmitWindowSize shorter
+ * than connInterval, see conn_params_valid() */
+#define CONN_INTERVAL_MIN		6	/* 7.5 ms */
+#define CONN_INTERVAL_MAX		3200	/* 4 s */
+#define CONN_TIMEOUT_MIN		10	/* 100 ms */
+#define CONN_TIMEOUT_MAX		3200	/* 32 s */
+#define CONN_LATENCY_MAX		499
+#define CONN_WIN_SIZE_MAX		8	/* 10 ms */
+#define CONN_HOP_MIN			5
+#define CONN_HOP_MAX			16
+
+/* The connection event timer expires this long before the anchor point, so the
+ * master transmits at the anchor point */
+#define T_CONN_SETUP			RADIO_RAMP_UP
+
+/* Link Layer specification Section 4.1, Core 4.1 page 2524 */
+#define T_IFS				150
+
+/* Link Layer specification Section 2.1, Core 4.1 page 2503
+ * Preamble and Access Address (T_CONN_AA), and the other fields of a packet
+ * around its payload: header and CRC, in us at 1 Mbps */
+#define T_CONN_AA			40
+#define T_CONN_PDU(len)			(T_CONN_AA + (2 + (len) + 3) * 8)
+
+/* A packet of the largest data PDU, and the T_IFS before it */
+#define T_CONN_PACKET_MAX		(T_IFS + T_CONN_PDU(LL_DATA_MTU_PAYLOAD))
+
+/* The slave receive window is widened on each side by this margin, for the
+ * jitter of the master's transmissions and the radio timings. The anchor
+ * points are captured by the radio hardware, so they do not depend on the
+ * interrupt latency. The window is opened by the connection timer interrupt,
+ * which shares IRQ_PRIORITY_HIGH with the radio: a window opened more than the
+ * margin late may miss the first packet of the master, but only for that
+ * event.
+ */
+#define T_CONN_RX_MARGIN		32
+
+/* Sleep clock accuracy of this device, in ppm. The connection events are timed
+ * by TIMER0, from the 16 MHz crystal.
+ */
+#ifndef CONFIG_LL_SCA_PPM
+#define CONFIG_LL_SCA_PPM		50
+#endif
+
+#ifndef CONFIG_LL_CONN_MAX
+#define CONFIG_LL_CONN_MAX		8
+#endif
+
+/* Time reserved for each connection event, at least. The new master
+ * connections are placed so that their reserved times do not overlap (see
+ * ll_conn_plan()). */
+#define T_CONN_EVENT_MIN		1250
+
+/* The planned first anchor point of a master connection is at least this long
+ * after the start of the transmit window, which is computed from an estimated
+ * end of the CONNECT_REQ PDU (see ll_conn_plan_offset()) */
+#define T_CONN_PLAN_GUARD		50
+
+/* Number of data PDUs queued for transmission, and received, on each
+ * connection. Must be a power of two. The PDUs are held in the buffers of the
+ * pools (see ll-pool.h).
+ */
+#ifndef CONFIG_LL_CONN_QUEUE
+#define CONFIG_LL_CONN_QUEUE		4
+#endif
+
+STATIC_ASSERT(CONFIG_LL_CONN_QUEUE > 0 && CONFIG_LL_CONN_QUEUE <= 128 &&
+		!(CONFIG_LL_CONN_QUEUE & (CONFIG_LL_CONN_QUEUE - 1)));
+
+#define CONN_QUEUE_IDX(i)		((i) & (CONFIG_LL_CONN_QUEUE - 1))
+
+/* Link Layer specification Section 2.4, Core 4.1 pages 2511-2512 */
+#define LL_DATA_HDR_LEN			2
+
+/* Link Layer specification Section 2.4.2, Core 4.1 pages 2512-2520
+ * LL control PDUs: opcode, followed by CtrData */
+#define LL_CTRL_CONN_UPDATE_REQ		0x00
+#define LL_CTRL_CHANNEL_MAP_REQ		0x01
+#define LL_CTRL_TERMINATE_IND		0x02
+#define LL_CTRL_UNKNOWN_RSP		0x07
+
+#define LL_CTRL_CONN_UPDATE_REQ_LEN	12
+#define LL_CTRL_CHANNEL_MAP_REQ_LEN	8
+#define LL_CTRL_TERMINATE_IND_LEN	2
+#define LL_CTRL_UNKNOWN_RSP_LEN		2
+
+/* Link Layer specification Section 5.1.2, Core 4.1
+ * The instant of a procedure is set at least 6 connection events ahead (after
+ * the slave latency), for the retransmissions of the request */
+#define CONN_INSTANT_DELAY		6
+
+/* Traffic-adaptive connection parameters (see conn_policy()): the master moves
+ * the connection to its shortest interval after CONFIG_LL_CONN_BURST_EVENTS
+ * events in a row ending with data left, and to its longest interval after
+ * CONFIG_LL_CONN_IDLE_TIME us without data */
+#ifndef CONFIG_LL_CONN_BURST_EVENTS
+#define CONFIG_LL_CONN_BURST_EVENTS	2
+#endif
+
+#ifndef CONFIG_LL_CONN_IDLE_TIME
+#define CONFIG_LL_CONN_IDLE_TIME	2000000
+#endif
+
+/* Period of the data channels classification, see ll-chmap.h */
+#ifndef CONFIG_LL_CHMAP_PERIOD
+#define CONFIG_LL_CHMAP_PERIOD		2000000		/* us */
+#endif
+
+/* PDU sent last, see conn_prepare_tx() */
+#define CONN_TX_EMPTY			0
+#define CONN_TX_DATA			1	/* the first queued PDU */
+#define CONN_TX_CTRL			2	/* the LL control PDU */
+
+struct __attribute__ ((packed)) ll_pdu_data {
+	uint8_t		llid:2;
+	uint8_t		nesn:1;		/* Next expected sequence number */
+	uint8_t		sn:1;		/* Sequence number */
+	uint8_t		md:1;		/* More data */
+	uint8_t		_rfu_0:3;	/* Reserved for future use */
+
+	uint8_t		length:5;	/* 0 <= payload length <= 27 */
+	uint8_t		_rfu_1:3;	/* Reserved for future use */
+
+	uint8_t		payload[LL_DATA_MTU_PAYLOAD];
+};
+
+struct ll_conn {
+	bool		used;
+	bool		established;	/* a packet was received */
+	uint8_t		role;
+	bdaddr_t	peer;
+
+	uint32_t	aa;
+	uint32_t	crc_init;
+	uint16_t	interval;	/* connInterval (*1.25ms) */
+	uint16_t	latency;	/* connSlaveLatency */
+	uint16_t	timeout;	/* connSupervisionTimeout (*10ms) */
+
+	uint16_t	event_counter;
+	uint32_t	anchor;		/* anchor point of the next event */
+	uint32_t	last_rx;	/* last packet received with a valid CRC */
+
+	/* Scheduling, see conn_schedule() */
+	uint32_t	start;		/* start of the next event */
+	uint32_t	ce_len;		/* time reserved for each event, us */
+	uint32_t	ce_max;		/* maximum event length, us */
+	uint8_t		skipped;	/* events lost to others in a row */
+	uint16_t	lat_skipped;	/* events skipped with the slave latency,
+					 * in a row */
+
+	/* Slave receive window, see conn_event_time() */
+	uint32_t	last_anchor;	/* last anchor point received */
+	uint16_t	sca_ppm;	/* master + slave sleep clock accuracy */
+	uint32_t	widening;	/* windowWidening of the next event */
+	uint32_t	win_size;	/* transmitWindowSize in us, until the
+					 * first packet is received */
+
+	struct ll_chsel	chsel;
+	uint8_t		ch;		/* data channel of the next event */
+
+	/* Acknowledgement and flow control, see conn_rx() */
+	uint8_t		sn;		/* transmitSeqNum */
+	uint8_t		nesn;		/* nextExpectedSeqNum */
+	bool		tx_unacked;	/* the last PDU sent is not acked */
+	uint8_t		tx_pdu;		/* ... and it is CONN_TX_* */
+
+	/* LL control procedures, see conn_rx_ctrl() */
+	struct ll_pdu_data ctrl_pdu;
+	uint8_t		ctrl_len;	/* pending LL control PDU, if not 0 */
+	bool		terminate;	/* closed at the end of the event */
+	uint8_t		term_reason;
+
+	/* Channel map update, at the event chm_instant */
+	uint64_t	ch_host;	/* channels allowed by the host */
+	uint8_t		ch_host_seq;	/* host_map_seq of ch_host */
+	bool		chm_pending;
+	uint64_t	chm_new;
+	uint16_t	chm_instant;
+
+	/* Connection update, at the event cu_instant */
+	bool		cu_pending;
+	uint16_t	cu_instant;
+	uint8_t		cu_win_size;
+	uint16_t	cu_win_offset;
+	uint16_t	cu_interval;
+	uint16_t	cu_latency;
+	uint16_t	cu_timeout;
+
+	/* Traffic-adaptive parameters (master), see conn_policy() */
+	uint16_t	interval_min;
+	uint16_t	interval_max;
+	uint16_t	latency_idle;
+	uint32_t	last_data;	/* last data PDU exchanged */
+	uint8_t		busy;		/* events ending with data left */
+	bool		peer_md;	/* MD bit of the last PDU received */
+
+	/* Data PDU queues: single producer (head) and single consumer (tail),
+	 * the application and the radio interrupt, so no locking is needed.
+	 * The indexes are free running and only wrapped when accessing the
+	 * arrays. The transmitted PDUs are dequeued once acknowledged.
+	 */
+	uint8_t		*tx_q[CONFIG_LL_CONN_QUEUE];
+	volatile uint8_t tx_head;	/* ll_conn_send() */
+	volatile uint8_t tx_tail;	/* radio interrupt */
+	uint8_t		*rx_q[CONFIG_LL_CONN_QUEUE];
+	volatile uint8_t rx_head;	/* radio interrupt */
+	volatile uint8_t rx_tail;	/* ll_conn_recv() */
+};
+
+static struct ll_conn conns[CONFIG_LL_CONN_MAX];
+
+/* Connection of the next (or current) connection event */
+static struct ll_conn *conn_cur;
+static volatile bool conn_in_event;
+
+/* Position of the next master connection, see ll_conn_plan(). The events of
+ * the connection are placed at phase us after the anchor points of the
+ * reference connection, modulo its interval (period). */
+static struct {
+	struct ll_conn	*ref;		/* NULL if not placed */
+	uint32_t	phase;
+	uint32_t	period;
+	uint32_t	ce_len;
+	uint32_t	ce_max;
+	uint64_t	ch_host;	/* channel map of the host */
+	uint8_t		ch_host_seq;
+	uint16_t	interval_min;
+	uint16_t	interval_max;
+	uint16_t	latency;
+	uint32_t	anchor;		/* first anchor point */
+} plan;
+
+/* Current connection event: no packet is exchanged after the deadline (see
+ * conn_event_more()), and the slave is synchronized on the first packet */
+static uint32_t conn_deadline;
+static bool conn_first_rx;
+
+/* Next classification of the data channels */
+static uint32_t chmap_due;
+
+/* Channel map of the host for the master connections, see ll_conn_set_ch_map().
+ * It is written out of the radio interrupt in the slot not in use, then
+ * host_map_seq tells the connections to take it at the end of their event. */
+static uint64_t host_map[2];
+static volatile uint8_t host_map_idx;
+static volatile uint8_t host_map_seq;
+
+/* PDU being sent, see conn_prepare_tx() */
+static struct ll_pdu_data *conn_tx;
+
+/* Link Layer specification Section 2.4, Core 4.1 page 2512
+ * Empty PDUs, preformatted for each value of the NESN, SN and MD bits (bits 2
+ * to 4 of the header). They are sent as is, so they stay in RAM for the radio
+ * EasyDMA.
+ */
+#define CONN_EMPTY(bits)		{ LL_LLID_CONT | ((bits) << 2), 0 }
+#define CONN_EMPTY_IDX(nesn, sn, md)	((nesn) | ((sn) << 1) | ((md) << 2))
+
+static uint8_t conn_empty[8][LL_DATA_HDR_LEN] __attribute__ ((aligned(4))) = {
+	CONN_EMPTY(0), CONN_EMPTY(1), CONN_EMPTY(2), CONN_EMPTY(3),
+	CONN_EMPTY(4), CONN_EMPTY(5), CONN_EMPTY(6), CONN_EMPTY(7),
+};
+
+/* Link Layer specification Section 2.3.3.1, Core 4.1 page 2510
+ * Upper bound of the master sleep clock accuracy for each SCA field value */
+static const uint16_t sca_ppm[] = { 500, 250, 150, 100, 75, 50, 30, 20 };
+
+static int16_t t_conn;
+static conn_evt_cb_t conn_evt_cb;
+static ll_conn_idle_cb_t conn_idle_cb;
+static ll_conn_radio_cb_t conn_radio_cb;
+
+static void conn_notify(struct ll_conn *c, uint8_t type, uint8_t reason)
+{
+	struct ll_conn_evt evt;
+
+	if (conn_evt_cb == NULL)
+		return;
+
+	evt.type = type;
+	evt.handle = c - conns;
+	evt.role = c->role;
+	evt.reason = reason;
+	evt.peer = c->peer;
+	evt.interval = c->interval;
+	evt.latency = c->latency;
+	evt.timeout = c->timeout;
+
+	conn_evt_cb(&evt);
+}
+
+/* Release the PDUs waiting for transmission. The received ones are kept until
+ * read by the application (see conn_alloc()). */
+static void conn_tx_flush(struct ll_conn *c)
+{
+	uint8_t tail = c->tx_tail;
+
+	while (tail != c->tx_head) {
+		__sync_synchronize();
+		ll_pool_free(LL_POOL_TX, c->tx_q[CONN_QUEUE_IDX(tail)]);
+		tail++;
+	}
+
+	__sync_synchronize();
+	c->tx_tail = tail;
+	c->tx_unacked = false;
+	c->ctrl_len = 0;
+}
+
+static void conn_close(struct ll_conn *c, uint8_t reason)
+{
+	c->used = false;
+	conn_tx_flush(c);
+	conn_notify(c, LL_CONN_EVT_DISCONNECTED, reason);
+
+	for (uint8_t i = 0; i < CONFIG_LL_CONN_MAX; i++) {
+		if (conns[i].used)
+			return;
+	}
+
+	if (conn_idle_cb)
+		conn_idle_cb();
+}
+
+/* Link Layer specification Section 5.1.1, Core 4.1
+ * At the instant, the new parameters are used from a transmit window placed
+ * after the old anchor point, like after a CONNECT_REQ. The slave listens
+ * during the whole window, and keeps widening from its last anchor point.
+ */
+static void conn_update_apply(struct ll_conn *c)
+{
+	c->cu_pending = false;
+
+	c->anchor += c->cu_win_offset * T_CONN_UNIT;
+	c->interval = c->cu_interval;
+	c->latency = c->cu_latency;
+	c->timeout = c->cu_timeout;
+
+	if (c->role == LL_CONN_ROLE_SLAVE) {
+		c->win_size = c->cu_win_size * T_CONN_UNIT;
+		c->ce_max = c->interval * T_CONN_UNIT;
+	}
+
+	conn_notify(c, LL_CONN_EVT_UPDATED, 0);
+}
+
+/* Move to the next connection event, whether the current one took place or
+ * not: the data channel depends on the number of events since the start. The
+ * peer uses the new channel map from its instant, so the connection can not go
+ * on without it. */
+static void conn_advance(struct ll_conn *c)
+{
+	c->event_counter++;
+	c->anchor += c->interval * T_CONN_UNIT;
+
+	if (c->chm_pending && c->event_counter == c->chm_instant) {
+		if (ll_chsel_set_map(&c->chsel, c->chm_new) < 0) {
+			c->terminate = true;
+			c->term_reason = LL_CONN_REASON_INVALID_PARAMS;
+		}
+		c->chm_pending = false;
+	}
+
+	if (c->cu_pending && c->event_counter == c->cu_instant)
+		conn_update_apply(c);
+
+	c->ch = ll_chsel_next(&c->chsel, c->event_counter);
+}
+
+/* Link Layer specification Section 2.3.3.1, Core 4.1 pages 2509-2510 */
+static bool conn_params_valid(uint8_t win_size, uint16_t win_offset,
+			uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+	if (interval < CONN_INTERVAL_MIN || interval > CONN_INTERVAL_MAX)
+		return false;
+
+	if (timeout < CONN_TIMEOUT_MIN || timeout > CONN_TIMEOUT_MAX
+				|| latency > CONN_LATENCY_MAX
+				|| timeout * 4 <= (latency + 1) * interval)
+		return false;
+
+	if (win_size == 0 || win_size > CONN_WIN_SIZE_MAX
+				|| win_size > interval - 1
+				|| win_offset > interval)
+		return false;
+
+	return true;
+}
+
+/* Link Layer specification Section 4.5.2, Core 4.1 page 2540 */
+static bool conn_lost(struct ll_conn *c, uint32_t now)
+{
+	uint32_t timeout;
+
+	if (c->established)
+		timeout = c->timeout * T_CONN_TIMEOUT_UNIT;
+	else
+		timeout = CONN_ESTABLISH_INTERVALS * c->interval * T_CONN_UNIT;
+
+	return now - c->last_rx >= timeout;
+}
+
+/* Link Layer specification Section 4.5.7, Core 4.1 pages 2543-2544
+ * windowWidening = (masterSCA + slaveSCA) / 1000000 * timeSinceLastAnchor,
+ * rounded up. timeSinceLastAnchor is bounded by connSupervisionTimeout (32 s),
+ * so elapsed / 16 * sca_ppm fits in 32 bits.
+ */
+static uint32_t conn_widening(struct ll_conn *c, uint32_t elapsed)
+{
+	uint32_t widening = ((elapsed >> 4) * c->sca_ppm + 62499) / 62500;
+	uint32_t max = c->interval * T_CONN_UNIT / 2 - T_IFS;
+
+	return (widening < max) ? widening : max;
+}
+
+/* Timestamp at which the next event of a connection is started. The master
+ * transmits at the anchor point. The slave listens from the anchor point
+ * expected from the last anchor point received, minus the window widening,
+ * until the end of the transmit window (if not synchronized yet) plus the
+ * window widening.
+ */
+static uint32_t conn_event_time(struct ll_conn *c)
+{
+	if (c->role == LL_CONN_ROLE_MASTER)
+		return c->anchor - T_CONN_SETUP;
+
+	c->widening = conn_widening(c, c->anchor - c->last_anchor);
+
+	return c->anchor - c->widening - T_CONN_RX_MARGIN - RADIO_RAMP_UP;
+}
+
+/* Time reserved for the next event of a connection, from its start */
+static uint32_t conn_event_len(struct ll_conn *c)
+{
+	if (c->role == LL_CONN_ROLE_MASTER)
+		return c->ce_len;
+
+	return c->ce_len + 2 * (c->widening + T_CONN_RX_MARGIN) + c->win_size;
+}
+
+/* An event not attended because it could not be started in time, or because
+ * of another connection event */
+static void conn_skip(struct ll_conn *c)
+{
+	c->skipped++;
+	conn_advance(c);
+
+	if (conn_lost(c, timer_get_timestamp()))
+		conn_close(c, c->established ? LL_CONN_REASON_TIMEOUT
+						: LL_CONN_REASON_FAILED);
+}
+
+static void conn_event_start(void);
+
+/* Program the timer for the earliest connection event. When it overlaps the
+ * next events of other connections, the connection that lost more events in a
+ * row goes first (the earliest event, for a tie), so the links share the
+ * conflicts. The events that can not be started in time are skipped.
+ */
+static void conn_schedule(void)
+{
+	struct ll_conn *next, *c;
+	uint32_t end;
+	uint8_t i;
+
+	timer_stop(t_conn);
+
+again:
+	next = NULL;
+
+	for (i = 0; i < CONFIG_LL_CONN_MAX; i++) {
+		c = &conns[i];
+
+		if (!c->used)
+			continue;
+
+		c->start = conn_event_time(c);
+
+		if (next == NULL || TIMER_BEFORE(c->start, next->start))
+			next = c;
+	}
+
+	conn_cur = next;
+
+	if (next == NULL)
+		return;
+
+	end = next->start + conn_event_len(next);
+
+	for (i = 0; i < CONFIG_LL_CONN_MAX; i++) {
+		c = &conns[i];
+
+		if (c == next || !c->used || !TIMER_BEFORE(c->start, end))
+			continue;
+
+		if (c->skipped > next->skipped) {
+			conn_skip(next);
+			goto again;
+		}
+	}
+
+	if (timer_start_at(t_conn, next->start, conn_event_start) < 0) {
+		conn_skip(next);
+		goto again;
+	}
+}
+
+/* PDUs waiting for transmission, LL control PDU included */
+static __inline uint8_t conn_tx_pending(struct ll_conn *c)
+{
+	return (uint8_t) (c->tx_head - c->tx_tail) + (c->ctrl_len ? 1 : 0);
+}
+
+static __inline void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static __inline uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+/* Instant of a procedure for the master: after the events the slave may skip,
+ * and the retransmissions of the request */
+static __inline uint16_t conn_instant(struct ll_conn *c)
+{
+	return c->event_counter + c->latency + CONN_INSTANT_DELAY;
+}
+
+/* The instant of a received request is already passed (modulo 65536): the
+ * connection is closed. The current event is already passed too. */
+static bool conn_instant_passed(struct ll_conn *c, uint16_t instant)
+{
+	uint16_t delta = instant - c->event_counter;
+
+	if (delta != 0 && delta < 0x8000)
+		return false;
+
+	c->terminate = true;
+	c->term_reason = LL_CONN_REASON_INSTANT;
+
+	return true;
+}
+
+/* Queue a LL control PDU, sent before the data PDUs. A single one is pending at
+ * a time. */
+static int16_t conn_ctrl_send(struct ll_conn *c, const uint8_t *ctrl,
+								uint8_t len)
+{
+	if (c->ctrl_len)
+		return -EBUSY;
+
+	c->ctrl_pdu.llid = LL_LLID_CTRL;
+	c->ctrl_pdu.length = len;
+	memcpy(c->ctrl_pdu.payload, ctrl, len);
+	c->ctrl_len = len;
+
+	return 0;
+}
+
+/* Link Layer specification Section 5.1.2, Core 4.1
+ * The master moves the connection to the channel map of the host without the
+ * bad channels (see ll-chmap.h), whenever it changes.
+ */
+static void conn_chm_update(struct ll_conn *c)
+{
+	uint8_t req[LL_CTRL_CHANNEL_MAP_REQ_LEN];
+	uint64_t map;
+	uint16_t instant;
+
+	if (c->chm_pending || c->cu_pending || c->ctrl_len)
+		return;
+
+	map = ll_chmap_filter(c->ch_host);
+	if (map == c->chsel.mask)
+		return;
+
+	instant = conn_instant(c);
+
+	req[0] = LL_CTRL_CHANNEL_MAP_REQ;
+	memcpy(&req[1], &map, 5);
+	put_le16(&req[6], instant);
+
+	if (conn_ctrl_send(c, req, sizeof(req)) < 0)
+		return;
+
+	c->chm_new = map;
+	c->chm_instant = instant;
+	c->chm_pending = true;
+}
+
+/* Link Layer specification Section 5.1.1, Core 4.1
+ * The transmit window starts at the old anchor point of the instant, the
+ * master sends its first packet at its start. */
+static void conn_update_req(struct ll_conn *c, uint16_t interval,
+							uint16_t latency)
+{
+	uint8_t req[LL_CTRL_CONN_UPDATE_REQ_LEN];
+	uint16_t instant = conn_instant(c);
+
+	req[0] = LL_CTRL_CONN_UPDATE_REQ;
+	req[1] = 1;				/* WinSize */
+	put_le16(&req[2], 0);			/* WinOffset */
+	put_le16(&req[4], interval);
+	put_le16(&req[6], latency);
+	put_le16(&req[8], c->timeout);
+	put_le16(&req[10], instant);
+
+	if (conn_ctrl_send(c, req, sizeof(req)) < 0)
+		return;
+
+	c->cu_win_size = 1;
+	c->cu_win_offset = 0;
+	c->cu_interval = interval;
+	c->cu_latency = latency;
+	c->cu_timeout = c->timeout;
+	c->cu_instant = instant;
+	c->cu_pending = true;
+	c->busy = 0;
+}
+
+/* Traffic-adaptive connection parameters of a master connection, within the
+ * range of ll_set_conn_params(). During a burst of data (events ending with
+ * data left on either side), the interval is the shortest, without slave
+ * latency. When idle, it is the longest, with the requested slave latency, as
+ * long as the supervision timeout allows it.
+ */
+static void conn_policy(struct ll_conn *c, uint32_t now)
+{
+	uint16_t interval, latency, max;
+
+	if (conn_tx_pending(c) || c->peer_md) {
+		if (c->busy < UINT8_MAX)
+			c->busy++;
+	} else {
+		c->busy = 0;
+	}
+
+	if (c->chm_pending || c->cu_pending || c->ctrl_len)
+		return;
+
+	if (c->busy >= CONFIG_LL_CONN_BURST_EVENTS) {
+		interval = c->interval_min;
+		latency = 0;
+	} else if (now - c->last_data >= CONFIG_LL_CONN_IDLE_TIME) {
+		interval = c->interval_max;
+		latency = c->latency_idle;
+	} else {
+		return;
+	}
+
+	/* Link Layer specification Section 2.3.3.1, Core 4.1 page 2510 */
+	max = (c->timeout * 4 - 1) / interval;
+	if (max == 0)
+		return;
+
+	if (latency >= max)
+		latency = max - 1;
+
+	if (interval != c->interval || latency != c->latency)
+		conn_update_req(c, interval, latency);
+}
+
+static void conn_event_close(struct ll_conn *c)
+{
+	uint32_t now;
+	uint8_t seq;
+
+	conn_in_event = false;
+
+	if (c->role == LL_CONN_ROLE_MASTER && c->established) {
+		now = timer_get_timestamp();
+
+		if (!TIMER_BEFORE(now, chmap_due)) {
+			chmap_due = now + CONFIG_LL_CHMAP_PERIOD;
+			ll_chmap_classify();
+		}
+
+		seq = host_map_seq;
+		if (seq != c->ch_host_seq) {
+			c->ch_host = host_map[host_map_idx];
+			c->ch_host_seq = seq;
+		}
+
+		conn_chm_update(c);
+		conn_policy(c, now);
+	}
+
+	conn_advance(c);
+
+	if (c->terminate)
+		conn_close(c, c->term_reason);
+	else if (conn_lost(c, timer_get_timestamp()))
+		conn_close(c, c->established ? LL_CONN_REASON_TIMEOUT
+						: LL_CONN_REASON_FAILED);
+
+	conn_schedule();
+
+	/* The other states can use the radio until the next event */
+	if (conn_radio_cb)
+		conn_radio_cb(false);
+}
+
+/* Link Layer specification Section 5.1.2, Core 4.1
+ * The new channel map is used from the instant. An instant already passed
+ * (modulo 65536), or a map with less than two channels, ends the connection.
+ */
+static void conn_rx_chm_req(struct ll_conn *c, const uint8_t *data)
+{
+	struct ll_chsel cs = { .algo = LL_CHSEL_CSA2 };
+	uint64_t map = 0;
+	uint16_t instant = get_le16(&data[5]);
+
+	memcpy(&map, data, 5);
+
+	if (conn_instant_passed(c, instant))
+		return;
+
+	if (ll_chsel_set_map(&cs, map) < 0) {
+		c->terminate = true;
+		c->term_reason = LL_CONN_REASON_INVALID_PARAMS;
+		return;
+	}
+
+	c->chm_new = cs.mask;
+	c->chm_instant = instant;
+	c->chm_pending = true;
+}
+
+/* Link Layer specification Section 5.1.1, Core 4.1
+ * Invalid parameters are ignored, see conn_params_valid() */
+static void conn_rx_cu_req(struct ll_conn *c, const uint8_t *data)
+{
+	uint8_t win_size = data[0];
+	uint16_t win_offset = get_le16(&data[1]);
+	uint16_t interval = get_le16(&data[3]);
+	uint16_t latency = get_le16(&data[5]);
+	uint16_t timeout = get_le16(&data[7]);
+	uint16_t instant = get_le16(&data[9]);
+
+	if (conn_instant_passed(c, instant))
+		return;
+
+	if (!conn_params_valid(win_size, win_offset, interval, latency,
+								timeout))
+		return;
+
+	c->cu_win_size = win_size;
+	c->cu_win_offset = win_offset;
+	c->cu_interval = interval;
+	c->cu_latency = latency;
+	c->cu_timeout = timeout;
+	c->cu_instant = instant;
+	c->cu_pending = true;
+}
+
+/* Link Layer specification Section 5.1, Core 4.1
+ * The procedures not supported are answered with LL_UNKNOWN_RSP. When the
+ * answer can not be queued, the PDU is not acknowledged, so the peer sends it
+ * again later.
+ */
+static int16_t conn_rx_ctrl(struct ll_conn *c, const struct ll_pdu_data *pdu)
+{
+	const uint8_t *p = pdu->payload;
+	uint8_t rsp[LL_CTRL_UNKNOWN_RSP_LEN];
+
+	switch (p[0]) {
+	case LL_CTRL_CONN_UPDATE_REQ:
+		if (c->role == LL_CONN_ROLE_SLAVE
+				&& pdu->length == LL_CTRL_CONN_UPDATE_REQ_LEN)
+			conn_rx_cu_req(c, &p[1]);
+		return 0;
+
+	case LL_CTRL_CHANNEL_MAP_REQ:
+		if (c->role == LL_CONN_ROLE_SLAVE
+				&& pdu->length == LL_CTRL_CHANNEL_MAP_REQ_LEN)
+			conn_rx_chm_req(c, &p[1]);
+		return 0;
+
+	case LL_CTRL_TERMINATE_IND:
+		if (pdu->length == LL_CTRL_TERMINATE_IND_LEN) {
+			c->terminate = true;
+			c->term_reason = p[1];
+		}
+		return 0;
+
+	case LL_CTRL_UNKNOWN_RSP:
+		return 0;
+
+	default:
+		rsp[0] = LL_CTRL_UNKNOWN_RSP;
+		rsp[1] = p[0];
+		return conn_ctrl_send(c, rsp, sizeof(rsp));
+	}
+}
+
+/* Queue a new PDU for the application, or handle a LL control PDU. Empty PDUs
+ * are not queued.
+ */
+static int16_t conn_rx_queue(struct ll_conn *c, const struct ll_pdu_data *pdu)
+{
+	uint8_t head = c->rx_head;
+	uint8_t *buf;
+
+	if (pdu->length == 0 || pdu->length > LL_DATA_MTU_PAYLOAD)
+		return 0;
+
+	if (pdu->llid == LL_LLID_CTRL)
+		return conn_rx_ctrl(c, pdu);
+
+	if ((uint8_t) (head - c->rx_tail) == CONFIG_LL_CONN_QUEUE)
+		return -ENOMEM;
+
+	buf = ll_pool_alloc(LL_POOL_RX);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	memcpy(buf, pdu, LL_DATA_HDR_LEN + pdu->length);
+	c->rx_q[CONN_QUEUE_IDX(head)] = buf;
+	c->last_data = c->last_rx;
+
+	/* The PDU must be complete before it is published */
+	__sync_synchronize();
+	c->rx_head = head + 1;
+
+	conn_notify(c, LL_CONN_EVT_DATA, 0);
+
+	return 0;
+}
+
+/* Link Layer specification Section 4.5.9, Core 4.1 pages 2547-2549 */
+static void conn_rx(struct ll_conn *c, const struct ll_pdu_data *pdu)
+{
+	uint8_t tail;
+
+	c->last_rx = timer_get_timestamp();
+	c->established = true;
+	c->peer_md = pdu->md;
+
+	/* The peer acknowledges the last PDU sent */
+	if (pdu->nesn != c->sn) {
+		c->sn ^= 1;
+
+		if (c->tx_unacked && c->tx_pdu == CONN_TX_DATA) {
+			tail = c->tx_tail;
+			ll_pool_free(LL_POOL_TX, c->tx_q[CONN_QUEUE_IDX(tail)]);
+
+			__sync_synchronize();
+			c->tx_tail = tail + 1;
+			c->last_data = c->last_rx;
+		} else if (c->tx_unacked && c->tx_pdu == CONN_TX_CTRL) {
+			c->ctrl_len = 0;
+		}
+
+		c->tx_unacked = false;
+	}
+
+	/* New PDU, not a retransmission. It is not acknowledged if it can not
+	 * be queued, so the peer sends it again later (flow control). */
+	if (pdu->sn == c->nesn && conn_rx_queue(c, pdu) == 0)
+		c->nesn ^= 1;
+}
+
+/* Select the next PDU to send: the LL control PDU, the first queued PDU, or an
+ * empty PDU. A PDU not acknowledged is sent again, even an empty PDU, since
+ * the peer may have received it.
+ *
+ * The PDUs are sent from their own buffers, without copy: only the header bits
+ * are updated in place. A queued PDU stays in its pool buffer until it is
+ * acknowledged, see conn_rx(). This runs during the radio ramp-up.
+ */
+static void conn_prepare_tx(struct ll_conn *c)
+{
+	struct ll_pdu_data *pdu;
+	uint8_t pending = conn_tx_pending(c);
+	uint8_t md;
+
+	if (!c->tx_unacked) {
+		if (c->ctrl_len)
+			c->tx_pdu = CONN_TX_CTRL;
+		else if (pending)
+			c->tx_pdu = CONN_TX_DATA;
+		else
+			c->tx_pdu = CONN_TX_EMPTY;
+	}
+
+	md = (pending > (c->tx_pdu != CONN_TX_EMPTY ? 1 : 0));
+
+	switch (c->tx_pdu) {
+	case CONN_TX_DATA:
+		__sync_synchronize();
+		pdu = (struct ll_pdu_data *)
+					c->tx_q[CONN_QUEUE_IDX(c->tx_tail)];
+		break;
+
+	case CONN_TX_CTRL:
+		pdu = &c->ctrl_pdu;
+		break;
+
+	default:
+		pdu = (struct ll_pdu_data *)
+				conn_empty[CONN_EMPTY_IDX(c->nesn, c->sn, md)];
+		break;
+	}
+
+	if (c->tx_pdu != CONN_TX_EMPTY) {
+		pdu->sn = c->sn;
+		pdu->nesn = c->nesn;
+		pdu->md = md;
+	}
+
+	conn_tx = pdu;
+	radio_set_out_buffer((uint8_t *) pdu);
+
+	c->tx_unacked = true;
+}
+
+/* Link Layer specification Section 4.5.6, Core 4.1 pages 2542-2543
+ * The event goes on while either side has more data (the MD bit), if the given
+ * number of packets of the largest size still fit before its deadline.
+ */
+static bool conn_event_more(bool md, uint8_t packets)
+{
+	if (!md)
+		return false;
+
+	return !TIMER_BEFORE(conn_deadline, timer_get_timestamp()
+						+ packets * T_CONN_PACKET_MAX);
+}
+
+/* End of the connection event being started: after the maximum event length,
+ * before the next event of the connection, and before the next events of the
+ * other connections */
+static uint32_t conn_event_deadline(struct ll_conn *c)
+{
+	uint32_t period = c->interval * T_CONN_UNIT;
+	uint32_t deadline = c->anchor + c->ce_max;
+	uint32_t next = c->anchor + period - T_CONN_SETUP - T_CONN_RX_MARGIN;
+
+	if (c->role == LL_CONN_ROLE_SLAVE)
+		next -= conn_widening(c, c->anchor + period - c->last_anchor);
+
+	if (TIMER_BEFORE(next, deadline))
+		deadline = next;
+
+	for (uint8_t i = 0; i < CONFIG_LL_CONN_MAX; i++) {
+		struct ll_conn *o = &conns[i];
+
+		if (o != c && o->used && TIMER_BEFORE(o->start, deadline))
+			deadline = o->start;
+	}
+
+	return deadline;
+}
+
+/* The next packet of the master is chained by the radio after each packet
+ * received, it is completed here during the radio ramp-up, or cancelled. The
+ * event is closed after a CRC error.
+ */
+static void conn_master_recv_cb(const uint8_t *pdu, bool crc, bool active)
+{
+	const struct ll_pdu_data *rcvd_pdu = (const struct ll_pdu_data *) pdu;
+	struct ll_conn *c = conn_cur;
+
+	ll_chmap_count(c->ch, crc);
+
+	if (crc) {
+		conn_rx(c, rcvd_pdu);
+
+		if (active && conn_event_more(rcvd_pdu->md
+					|| conn_tx_pending(c), 2)) {
+			conn_prepare_tx(c);
+			radio_set_next(RADIO_FLAGS_RX_NEXT
+						| RADIO_FLAGS_TX_NEXT);
+			return;
+		}
+	}
+
+	if (active)
+		radio_stop();
+
+	conn_event_close(c);
+}
+
+/* Link Layer specification Section 4.5.5, Core 4.1 page 2542
+ * The slave is synchronized on the packets received from the master: the
+ * anchor point is the start of the first packet of the event. The answer is
+ * sent by the radio T_IFS after each packet, and it is completed here during
+ * the radio ramp-up. It is sent after a CRC error too (the received PDU is not
+ * acknowledged), but then the event is closed.
+ */
+static void conn_slave_recv_cb(const uint8_t *pdu, bool crc, bool active)
+{
+	const struct ll_pdu_data *rcvd_pdu = (const struct ll_pdu_data *) pdu;
+	struct ll_conn *c = conn_cur;
+
+	if (crc && conn_first_rx) {
+		c->anchor = radio_get_address_time() - T_CONN_AA;
+		c->last_anchor = c->anchor;
+		c->win_size = 0;
+		conn_first_rx = false;
+	}
+
+	if (crc)
+		conn_rx(c, rcvd_pdu);
+
+	/* No answer is being sent */
+	if (!active) {
+		conn_event_close(c);
+		return;
+	}
+
+	conn_prepare_tx(c);
+
+	/* The master sends its next packet after the answer */
+	if (crc && conn_event_more(rcvd_pdu->md || conn_tx->md, 3))
+		radio_set_next(RADIO_FLAGS_RX_NEXT | RADIO_FLAGS_TX_NEXT);
+}
+
+/* The slave answer was sent, and the slave listens for the next packet of the
+ * master if active */
+static void conn_slave_send_cb(bool active)
+{
+	if (!active)
+		conn_event_close(conn_cur);
+}
+
+/* The slave did not answer, or nothing was received by the slave */
+static void conn_timeout_cb(void)
+{
+	if (conn_cur->role == LL_CONN_ROLE_MASTER)
+		ll_chmap_count(conn_cur->ch, false);
+
+	conn_event_close(conn_cur);
+}
+
+/* Link Layer specification Section 4.5.1, Core 4.1 page 2537
+ * The slave may skip up to connSlaveLatency events in a row when it has
+ * nothing to send. It listens as soon as data is queued (from the next event),
+ * while its last PDU sent or the master's data are not acknowledged, and at
+ * the instant of a procedure. The window widening of the next attended event
+ * grows with the time since the last anchor point, see conn_event_time().
+ */
+static bool conn_latency_skip(struct ll_conn *c)
+{
+	if (c->role != LL_CONN_ROLE_SLAVE || !c->established
+				|| c->lat_skipped >= c->latency)
+		return false;
+
+	if (conn_tx_pending(c) || c->peer_md || c->terminate
+			|| (c->tx_unacked && c->tx_pdu != CONN_TX_EMPTY))
+		return false;
+
+	if ((c->chm_pending && c->event_counter == c->chm_instant)
+			|| (c->cu_pending && c->event_counter == c->cu_instant))
+		return false;
+
+	return true;
+}
+
+/* Link Layer specification Section 4.5.1, Core 4.1 page 2538
+ * The master starts each connection event by transmitting at the anchor point,
+ * the slave answers T_IFS after each packet it receives. The packets are
+ * exchanged back-to-back until the event is closed (see conn_event_more()).
+ */
+static void conn_event_start(void)
+{
+	struct ll_conn *c = conn_cur;
+	uint32_t window;
+
+	/* The radio stays with the other states */
+	if (conn_latency_skip(c)) {
+		c->lat_skipped++;
+		conn_advance(c);
+		conn_schedule();
+		return;
+	}
+
+	c->lat_skipped = 0;
+
+	/* Connection events take the radio from the other states */
+	conn_in_event = true;
+	radio_stop();
+
+	if (conn_radio_cb)
+		conn_radio_cb(true);
+
+	c->skipped = 0;
+	conn_deadline = conn_event_deadline(c);
+	conn_first_rx = true;
+
+	if (radio_prepare(c->ch, c->aa, c->crc_init) < 0) {
+		conn_event_close(c);
+		return;
+	}
+
+	radio_set_timeout_cb(conn_timeout_cb);
+
+	if (c->role == LL_CONN_ROLE_MASTER) {
+		conn_prepare_tx(c);
+		radio_set_callbacks(conn_master_recv_cb, NULL);
+		radio_send((const uint8_t *) conn_tx, RADIO_FLAGS_RX_NEXT
+							| RADIO_FLAGS_TX_NEXT);
+		return;
+	}
+
+	window = RADIO_RAMP_UP + 2 * (c->widening + T_CONN_RX_MARGIN)
+						+ c->win_size + T_CONN_AA;
+
+	radio_set_callbacks(conn_slave_recv_cb, conn_slave_send_cb);
+
+	if (radio_set_rx_window(window) < 0) {
+		conn_event_close(c);
+		return;
+	}
+
+	radio_recv(RADIO_FLAGS_TX_NEXT);
+}
+
+static uint8_t conn_count_role(uint8_t role)
+{
+	uint8_t n = 0;
+
+	for (uint8_t i = 0; i < CONFIG_LL_CONN_MAX; i++) {
+		if (conns[i].used && conns[i].role == role)
+			n++;
+	}
+
+	return n;
+}
+
+/* The PDUs received on a closed connection can still be read, so its entry is
+ * only reused once they are */
+static struct ll_conn *conn_alloc(void)
+{
+	for (uint8_t i = 0; i < CONFIG_LL_CONN_MAX; i++) {
+		struct ll_conn *c = &conns[i];
+
+		if (c->used || c->rx_tail != c->rx_head)
+			continue;
+
+		conn_tx_flush(c);
+		memset(c, 0, sizeof(*c));
+
+		return c;
+	}
+
+	return NULL;
+}
+
+/* Connection parameters from a CONNECT_REQ PDU, see Link Layer specification
+ * Section 2.3.3.1, Core 4.1 pages 2509-2510 */
+static int16_t conn_setup(struct ll_conn *c,
+			const struct ll_pdu_connect_payload *req, bool csa2)
+{
+	if (!conn_params_valid(req->win_size, req->win_offset, req->interval,
+						req->latency, req->timeout)
+				|| req->hop < CONN_HOP_MIN
+				|| req->hop > CONN_HOP_MAX)
+		return -EINVAL;
+
+	if (ll_chsel_init(&c->chsel, csa2 ? LL_CHSEL_CSA2 : LL_CHSEL_CSA1,
+					req->ch_map, req->hop, req->aa) < 0)
+		return -EINVAL;
+
+	c->ch_host = req->ch_map & LL_DATA_CH_ALL;
+	c->aa = req->aa;
+	c->crc_init = req->crc_init;
+	c->sca_ppm = sca_ppm[req->sca] + CONFIG_LL_SCA_PPM;
+	c->interval = req->interval;
+	c->latency = req->latency;
+	c->timeout = req->timeout;
+
+	c->ch = ll_chsel_next(&c->chsel, 0);
+
+	return 0;
+}
+
+/**@brief Enter the Connection state as master, after sending a CONNECT_REQ
+ *
+ * The first packet is sent at the start of the transmit window, and this is
+ * the first anchor point.
+ *
+ * @param [in] req: the CONNECT_REQ PDU payload
+ * @param [in] peer_type: the advertiser address type (RxAdd of the PDU)
+ * @param [in] timestamp: the end of the CONNECT_REQ PDU
+ * @param [in] csa2: Channel Selection Algorithm #2 is used (ChSel bits)
+ *
+ * @return the connection handle, or a negative error code
+ */
+int16_t ll_conn_master_start(const struct ll_pdu_connect_payload *req,
+			uint8_t peer_type, uint32_t timestamp, bool csa2)
+{
+	struct ll_conn *c = conn_alloc();
+
+	if (c == NULL)
+		return -ENOMEM;
+
+	if (conn_setup(c, req, csa2) < 0)
+		return -EINVAL;
+
+	c->role = LL_CONN_ROLE_MASTER;
+	c->peer.type = peer_type;
+	memcpy(c->peer.addr, req->adv_add, BDADDR_LEN);
+
+	/* Link Layer specification Section 4.5.3, Core 4.1 page 2541 */
+	c->anchor = timestamp + T_CONN_WINDOW_DELAY
+					+ req->win_offset * T_CONN_UNIT;
+
+	if (plan.ref && !TIMER_BEFORE(plan.anchor, c->anchor)
+			&& TIMER_BEFORE(plan.anchor, c->anchor
+					+ req->win_size * T_CONN_UNIT))
+		c->anchor = plan.anchor;
+
+	c->ce_len = plan.ce_len;
+	c->ce_max = plan.ce_max;
+	c->ch_host = plan.ch_host;
+	c->ch_host_seq = plan.ch_host_seq;
+	c->interval_min = plan.interval_min;
+	c->interval_max = plan.interval_max;
+	c->latency_idle = plan.latency;
+	c->last_data = timestamp;
+	c->last_rx = timestamp;
+
+	/* The first master connection starts the channels classification */
+	if (conn_count_role(LL_CONN_ROLE_MASTER) == 0)
+		chmap_due = timestamp + CONFIG_LL_CHMAP_PERIOD;
+
+	c->used = true;
+
+	conn_notify(c, LL_CONN_EVT_CONNECTED, 0);
+	conn_schedule();
+
+	return c - conns;
+}
+
+/**@brief Enter the Connection state as slave, after receiving a CONNECT_REQ
+ *
+ * The slave listens during the whole transmit window, widened, until the first
+ * packet of the master is received.
+ *
+ * @param [in] req: the CONNECT_REQ PDU payload
+ * @param [in] peer_type: the initiator address type (TxAdd of the PDU)
+ * @param [in] timestamp: the end of the CONNECT_REQ PDU
+ * @param [in] csa2: Channel Selection Algorithm #2 is used (ChSel bits)
+ *
+ * @return the connection handle, or a negative error code
+ */
+int16_t ll_conn_slave_start(const struct ll_pdu_connect_payload *req,
+			uint8_t peer_type, uint32_t timestamp, bool csa2)
+{
+	struct ll_conn *c = conn_alloc();
+
+	if (c == NULL)
+		return -ENOMEM;
+
+	if (conn_setup(c, req, csa2) < 0)
+		return -EINVAL;
+
+	c->role = LL_CONN_ROLE_SLAVE;
+	c->peer.type = peer_type;
+	memcpy(c->peer.addr, req->init_add, BDADDR_LEN);
+
+	/* Link Layer specification Section 4.5.3, Core 4.1 page 2541
+	 * The window widening grows from the end of the CONNECT_REQ PDU */
+	c->anchor = timestamp + T_CONN_WINDOW_DELAY
+					+ req->win_offset * T_CONN_UNIT;
+	c->last_anchor = timestamp;
+	c->win_size = req->win_size * T_CONN_UNIT;
+	c->ce_len = T_CONN_EVENT_MIN;
+	c->ce_max = c->interval * T_CONN_UNIT;
+	c->last_rx = timestamp;
+	c->used = true;
+
+	conn_notify(c, LL_CONN_EVT_CONNECTED, 0);
+	conn_schedule();
+
+	return c - conns;
+}
+
+/* Distance from a to b, modulo period */
+static uint32_t phase_diff(uint32_t a, uint32_t b, uint32_t period)
+{
+	int32_t r = (int32_t) (b - a) % (int32_t) period;
+
+	return (r < 0) ? r + period : r;
+}
+
+/* Check if [phase, phase + len) overlaps the time reserved for the master
+ * connections placed on the reference connection, modulo period */
+static bool plan_overlaps(struct ll_conn *ref, uint32_t phase, uint32_t len,
+							uint32_t period)
+{
+	for (uint8_t i = 0; i < CONFIG_LL_CONN_MAX; i++) {
+		struct ll_conn *c = &conns[i];
+		uint32_t p;
+
+		if (!c->used || c->role != LL_CONN_ROLE_MASTER
+				|| (c->interval * T_CONN_UNIT) % period)
+			continue;
+
+		p = phase_diff(ref->anchor, c->anchor, period);
+
+		if (phase_diff(p, phase, period) < c->ce_len
+				|| phase_diff(phase, p, period) < len)
+			return true;
+	}
+
+	return false;
+}
+
+/**@brief Choose the interval and the position of the next master connection
+ *
+ * The interval is the shortest multiple, within the requested range, of the
+ * shortest interval of the master connections (the reference). Then the events
+ * of every master connection with such an interval come back at the same
+ * position relative to the reference anchor points, and the new connection is
+ * placed right after one of them, where it overlaps none. Without existing
+ * master connection, nor a multiple in the range, nor room, the connection is
+ * not placed and its interval is the shortest of the range.
+ *
+ * @param [in] params: the requested connection parameters
+ * @param [in] ch_map: the data channels allowed by the host
+ * @param [out] interval: the connection interval (*1.25ms)
+ */
+int16_t ll_conn_plan(const ll_conn_params_t *params, uint64_t ch_map,
+							uint16_t *interval)
+{
+	struct ll_conn *ref = NULL;
+	uint32_t period, len, phase;
+	uint16_t k;
+	uint8_t i;
+
+	len = params->minimum_ce_length * 625;
+	if (len < T_CONN_EVENT_MIN)
+		len = T_CONN_EVENT_MIN;
+
+	plan.ref = NULL;
+	plan.ce_len = len;
+	plan.ch_host = ch_map;
+	plan.ch_host_seq = host_map_seq;
+	plan.interval_min = params->conn_interval_min;
+	plan.interval_max = params->conn_interval_max;
+	plan.latency = params->conn_latency;
+	plan.ce_max = params->maximum_ce_length * 625;
+	if (plan.ce_max < len)
+		plan.ce_max = len;
+	*interval = params->conn_interval_min;
+
+	for (i = 0; i < CONFIG_LL_CONN_MAX; i++) {
+		struct ll_conn *c = &conns[i];
+
+		if (c->used && c->role == LL_CONN_ROLE_MASTER
+				&& (ref == NULL || c->interval < ref->interval))
+			ref = c;
+	}
+
+	if (ref == NULL)
+		return 0;
+
+	k = (params->conn_interval_min + ref->interval - 1) / ref->interval;
+	if (k * ref->interval > params->conn_interval_max)
+		return 0;
+
+	period = ref->interval * T_CONN_UNIT;
+
+	for (i = 0; i < CONFIG_LL_CONN_MAX; i++) {
+		struct ll_conn *c = &conns[i];
+
+		if (!c->used || c->role != LL_CONN_ROLE_MASTER
+				|| (c->interval * T_CONN_UNIT) % period)
+			continue;
+
+		phase = phase_diff(ref->anchor, c->anchor, period) + c->ce_len;
+		if (phase >= period)
+			phase -= period;
+
+		if (!plan_overlaps(ref, phase, len, period)) {
+			plan.ref = ref;
+			plan.phase = phase;
+			plan.period = period;
+			*interval = k * ref->interval;
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/**@brief Transmit window offset for the planned position of a connection
+ *
+ * To be called when the CONNECT_REQ PDU is about to be sent, since the transmit
+ * window is relative to its end. The planned first anchor point is in the
+ * first 1.25 ms of a transmit window of 2.5 ms.
+ *
+ * @param [in] timestamp: the end of the advertising PDU being answered
+ *
+ * @return transmitWindowOffset (*1.25ms)
+ */
+uint16_t ll_conn_plan_offset(uint32_t timestamp)
+{
+	uint32_t start = timestamp + T_IFS + T_CONN_WINDOW_DELAY
+			+ T_CONN_PDU(sizeof(struct ll_pdu_connect_payload));
+
+	if (plan.ref == NULL || !plan.ref->used) {
+		plan.ref = NULL;
+		return 0;
+	}
+
+	plan.anchor = start + T_CONN_PLAN_GUARD;
+	plan.anchor += phase_diff(plan.anchor, plan.ref->anchor + plan.phase,
+								plan.period);
+
+	return (plan.anchor - start - T_CONN_PLAN_GUARD) / T_CONN_UNIT;
+}
+
+bool ll_conn_in_event(void)
+{
+	return conn_in_event;
+}
+
+uint8_t ll_conn_count(void)
+{
+	return conn_count_role(LL_CONN_ROLE_MASTER)
+				+ conn_count_role(LL_CONN_ROLE_SLAVE);
+}
+
+/**@brief Move the master connections to a new channel map of the host
+ *
+ * Each one sends a LL_CHANNEL_MAP_REQ at the end of its next event, see
+ * conn_chm_update(). Not to be called from the radio interrupt.
+ *
+ * @param [in] ch_map: the data channels allowed by the host
+ */
+void ll_conn_set_ch_map(uint64_t ch_map)
+{
+	uint8_t idx = host_map_idx ^ 1;
+
+	host_map[idx] = ch_map;
+	host_map_idx = idx;
+	host_map_seq++;
+}
+
+/* Value of the SCA field of the CONNECT_REQ PDUs sent by this device */
+uint8_t ll_conn_sca(void)
+{
+	uint8_t sca = 0;
+
+	while (sca < 7 && sca_ppm[sca + 1] >= CONFIG_LL_SCA_PPM)
+		sca++;
+
+	return sca;
+}
+
+/**@brief Set the callback function for connections creation and termination
+ *
+ * @param [in] cb: the callback function, or NULL
+ */
+int16_t ll_set_conn_evt_cb(conn_evt_cb_t cb)
+{
+	conn_evt_cb = cb;
+
+	return 0;
+}
+
+/**@brief Queue a data PDU for transmission on a connection
+ *
+ * The PDU is sent in the next connection events, after the ones already
+ * queued, and released once acknowledged by the peer.
+ *
+ * @param [in] handle: the connection handle
+ * @param [in] llid: LL_LLID_START or LL_LLID_CONT
+ * @param [in] data: the payload
+ * @param [in] len: the payload length, 1 to LL_DATA_MTU_PAYLOAD
+ *
+ * @return -EINVAL if handle, llid or len is invalid
+ * @return -ENOREADY if the connection is closed
+ * @return -EBUSY if the transmission queue of the connection is full
+ * @return -ENOMEM if no buffer is available
+ */
+int16_t ll_conn_send(uint8_t handle, uint8_t llid, const uint8_t *data,
+								uint8_t len)
+{
+	struct ll_conn *c;
+	struct ll_pdu_data *pdu;
+	uint8_t head;
+
+	if (handle >= CONFIG_LL_CONN_MAX || data == NULL || len == 0
+				|| len > LL_DATA_MTU_PAYLOAD
+				|| (llid != LL_LLID_START && llid != LL_LLID_CONT))
+		return -EINVAL;
+
+	c = &conns[handle];
+	if (!c->used)
+		return -ENOREADY;
+
+	head = c->tx_head;
+	if ((uint8_t) (head - c->tx_tail) == CONFIG_LL_CONN_QUEUE)
+		return -EBUSY;
+
+	pdu = (struct ll_pdu_data *) ll_pool_alloc(LL_POOL_TX);
+	if (pdu == NULL)
+		return -ENOMEM;
+
+	memset(pdu, 0, LL_DATA_HDR_LEN);
+	pdu->llid = llid;
+	pdu->length = len;
+	memcpy(pdu->payload, data, len);
+	c->tx_q[CONN_QUEUE_IDX(head)] = (uint8_t *) pdu;
+
+	/* The PDU must be complete before it is published */
+	__sync_synchronize();
+	c->tx_head = head + 1;
+
+	return 0;
+}
+
+/**@brief Read the next data PDU received on a connection
+ *
+ * The PDUs received before the connection was closed can still be read. Every
+ * received PDU is signaled by a LL_CONN_EVT_DATA event (see
+ * ll_set_conn_evt_cb()).
+ *
+ * @param [in] handle: the connection handle
+ * @param [out] llid: LL_LLID_START or LL_LLID_CONT
+ * @param [out] data: the payload, at least LL_DATA_MTU_PAYLOAD octets
+ *
+ * @return the payload length, 0 if no PDU was received
+ * @return -EINVAL if handle is invalid
+ */
+int16_t ll_conn_recv(uint8_t handle, uint8_t *llid, uint8_t *data)
+{
+	struct ll_conn *c;
+	const struct ll_pdu_data *pdu;
+	uint8_t tail, len;
+
+	if (handle >= CONFIG_LL_CONN_MAX || llid == NULL || data == NULL)
+		return -EINVAL;
+
+	c = &conns[handle];
+	tail = c->rx_tail;
+	if (tail == c->rx_head)
+		return 0;
+
+	__sync_synchronize();
+	pdu = (const struct ll_pdu_data *) c->rx_q[CONN_QUEUE_IDX(tail)];
+	*llid = pdu->llid;
+	len = pdu->length;
+	memcpy(data, pdu->payload, len);
+	ll_pool_free(LL_POOL_RX, (uint8_t *) pdu);
+
+	__sync_synchronize();
+	c->rx_tail = tail + 1;
+
+	return len;
+}
+
+int16_t ll_conn_init(ll_conn_idle_cb_t idle_cb, ll_conn_radio_cb_t radio_cb)
+{
+	int16_t err_code;
+
+	err_code = ll_pool_init();
+	if (err_code < 0)
+		return err_code;
+
+	err_code = ll_chmap_init();
+	if (err_code < 0)
+		return err_code;
+
+	t_conn = timer_create(TIMER_SINGLESHOT);
+	if (t_conn < 0)
+		return t_conn;
+
+	conn_idle_cb = idle_cb;
+	conn_radio_cb = radio_cb;
+	conn_cur = NULL;
+	conn_in_event = false;
+	plan.ref = NULL;
+	plan.ce_len = T_CONN_EVENT_MIN;
+	plan.ce_max = T_CONN_EVENT_MIN;
+	memset(conns, 0, sizeof(conns));
+
+	return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+/* Connection state
+ *
+ * The connections are kept in a table and share the radio. A single timer is
+ * programmed at the timestamp of the next connection event, so the anchor
+ * points do not accumulate the timer interrupt latency.
+ */
+
+/* Link Layer specification Section 1.4, Core 4.1 page 2501 */
+#define LL_DATA_CH_NB			37
+
+/* Link Layer specification Section 2.3.3.1, Core 4.1 page 2509
+ * CONNECT_REQ PDU payload */
+struct __attribute__ ((packed)) ll_pdu_connect_payload {
+	uint8_t		init_add[BDADDR_LEN];	/* Initiator address */
+	uint8_t		adv_add[BDADDR_LEN];	/* Advertiser address */
+	uint32_t	aa;			/* connection Access Address */
+	uint32_t	crc_init:24;		/* connection CRC init */
+	uint8_t		win_size;		/* tx window size (*1.25ms) */
+	uint16_t	win_offset;		/* tx window offset (*1.25ms) */
+	uint16_t	interval;		/* conn. interval (*1.25ms) */
+	uint16_t	latency;		/* conn. slave latency */
+	uint16_t	timeout;		/* conn. supervision (*10ms) */
+	uint64_t	ch_map:40;		/* channel map */
+	uint8_t		hop:5;			/* hop increment */
+	uint8_t		sca:3;			/* Master sleep clock accuracy */
+};
+
+/* Called when the last connection is closed */
+typedef void (*ll_conn_idle_cb_t)(void);
+
+/* Connection events take the radio from the other states (taken is true), and
+ * give it back at their end. Meanwhile, the other states must not operate the
+ * radio (see ll_conn_in_event()). */
+typedef void (*ll_conn_radio_cb_t)(bool taken);
+
+int16_t ll_conn_init(ll_conn_idle_cb_t idle_cb, ll_conn_radio_cb_t radio_cb);
+bool ll_conn_in_event(void);
+uint8_t ll_conn_count(void);
+int16_t ll_conn_plan(const ll_conn_params_t *params, uint64_t ch_map,
+							uint16_t *interval);
+uint16_t ll_conn_plan_offset(uint32_t timestamp);
+int16_t ll_conn_master_start(const struct ll_pdu_connect_payload *req,
+			uint8_t peer_type, uint32_t timestamp, bool csa2);
+int16_t ll_conn_slave_start(const struct ll_pdu_connect_payload *req,
+			uint8_t peer_type, uint32_t timestamp, bool csa2);
+void ll_conn_set_ch_map(uint64_t ch_map);
+uint8_t ll_conn_sca(void);
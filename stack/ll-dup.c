@@ -0,0 +1,160 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <blessed/errcodes.h>
+#include <blessed/bdaddr.h>
+
+#include "ll.h"
+#include "ll-dup.h"
+#include "assert.h"
+
+/* Number of devices remembered. Must be a power of two. */
+#ifndef CONFIG_LL_DUP_FILTER_SIZE
+#define CONFIG_LL_DUP_FILTER_SIZE	64
+#endif
+
+/* Slots probed from the home slot of a key (linear probing) */
+#define PROBE_MAX			8
+
+STATIC_ASSERT(CONFIG_LL_DUP_FILTER_SIZE >= PROBE_MAX &&
+		!(CONFIG_LL_DUP_FILTER_SIZE & (CONFIG_LL_DUP_FILTER_SIZE - 1)));
+
+#define SLOT(i)				((i) & (CONFIG_LL_DUP_FILTER_SIZE - 1))
+
+/* FNV-1a, 32 bits */
+#define FNV_OFFSET			2166136261UL
+#define FNV_PRIME			16777619UL
+
+/* The device is identified by its address, address type and PDU type (e.g. a
+ * SCAN_RSP is not a duplicate of an ADV_IND). Their hash only gives the home
+ * slot.
+ */
+struct dup_entry {
+	bool		used;
+	uint8_t		pdu_type;
+	uint8_t		addr_type;
+	uint8_t		addr[BDADDR_LEN];
+	uint16_t	data;		/* hash of the data */
+	uint32_t	seen;		/* timestamp of the last report */
+};
+
+static struct dup_entry entries[CONFIG_LL_DUP_FILTER_SIZE];
+static uint8_t dup_mode = LL_DUP_FILTER_NONE;
+static uint32_t dup_max_age;
+
+static __inline uint32_t fnv1a(uint32_t h, const uint8_t *data, uint8_t len)
+{
+	while (len--) {
+		h ^= *data++;
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+int16_t ll_dup_init(uint8_t mode, uint32_t max_age)
+{
+	if (mode > LL_DUP_FILTER_ADDR_DATA)
+		return -EINVAL;
+
+	dup_mode = mode;
+	dup_max_age = max_age;
+
+	return ll_dup_reset();
+}
+
+/* Forget every device, at the beginning of a scan session */
+int16_t ll_dup_reset(void)
+{
+	memset(entries, 0, sizeof(entries));
+
+	return 0;
+}
+
+/* Check if a PDU is a duplicate of an already reported one. If not, the device
+ * is remembered, and the PDU should be reported. Called from the radio
+ * interrupt: it runs in a bounded number of steps.
+ */
+bool ll_dup_check(uint8_t pdu_type, uint8_t addr_type, const uint8_t *addr,
+			const uint8_t *data, uint8_t len, uint32_t timestamp)
+{
+	struct dup_entry *e, *victim = NULL;
+	uint32_t home, h;
+	uint16_t dhash = 0;
+	uint8_t i;
+
+	if (dup_mode == LL_DUP_FILTER_NONE)
+		return false;
+
+	h = fnv1a(FNV_OFFSET, addr, BDADDR_LEN);
+	h = fnv1a(h, &addr_type, sizeof(addr_type));
+	home = fnv1a(h, &pdu_type, sizeof(pdu_type));
+
+	if (dup_mode == LL_DUP_FILTER_ADDR_DATA) {
+		h = fnv1a(FNV_OFFSET, data, len);
+		dhash = (uint16_t) (h ^ (h >> 16));
+	}
+
+	for (i = 0; i < PROBE_MAX; i++) {
+		e = &entries[SLOT(home + i)];
+
+		if (e->used && e->pdu_type == pdu_type
+				&& e->addr_type == addr_type
+				&& !memcmp(e->addr, addr, BDADDR_LEN)) {
+			if (e->data == dhash && (dup_max_age == 0 ||
+					timestamp - e->seen < dup_max_age))
+				return true;
+
+			victim = e;
+			break;
+		}
+
+		/* Slots are only freed by ll_dup_reset(): the device is not
+		 * further in the probe sequence */
+		if (!e->used) {
+			victim = e;
+			break;
+		}
+
+		/* Otherwise replace the least recently reported device */
+		if (victim == NULL || timestamp - e->seen
+						> timestamp - victim->seen)
+			victim = e;
+	}
+
+	victim->used = true;
+	victim->pdu_type = pdu_type;
+	victim->addr_type = addr_type;
+	memcpy(victim->addr, addr, BDADDR_LEN);
+	victim->seen = timestamp;
+	victim->data = dhash;
+
+	return false;
+}
@@ -0,0 +1,264 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <blessed/errcodes.h>
+#include <blessed/bdaddr.h>
+
+#include "ll.h"
+#include "ll-filter.h"
+#include "assert.h"
+
+STATIC_ASSERT(LL_FILTER_RULES_MAX <= 8);
+
+/* From Bluetooth SIG GAP assigned numbers */
+#define AD_UUID16_INCOMPLETE		0x02
+#define AD_UUID16_COMPLETE		0x03
+#define AD_UUID128_INCOMPLETE		0x06
+#define AD_UUID128_COMPLETE		0x07
+#define AD_SERVICE_DATA_UUID16		0x16
+#define AD_SERVICE_DATA_UUID128		0x21
+#define AD_MFR_DATA			0xFF
+
+#define UUID16_LEN			2
+#define UUID128_LEN			16
+#define COMPANY_ID_LEN			2
+
+/* Conditions checked in the AD structures */
+#define AD_CONDITIONS			(LL_FILTER_AD_TYPE | LL_FILTER_UUID16 | \
+					LL_FILTER_UUID128 | LL_FILTER_MFR)
+
+/* PDUs whose data are AD structures */
+#define AD_PDUS				(LL_FILTER_PDU(LL_PDU_ADV_IND) |	\
+					LL_FILTER_PDU(LL_PDU_ADV_NONCONN_IND) |	\
+					LL_FILTER_PDU(LL_PDU_ADV_SCAN_IND) |	\
+					LL_FILTER_PDU(LL_PDU_SCAN_RSP))
+
+/* A compiled rule: unused conditions always match, the address prefix and the
+ * manufacturer data are kept as they appear in the PDU */
+struct filter_rule {
+	uint8_t		pdu_types;
+	uint8_t		ad_conditions;
+	int8_t		rssi_min;
+	uint8_t		addr_len;
+	uint8_t		addr[BDADDR_LEN];	/* least significant first */
+	uint8_t		ad_type;
+	uint8_t		mfr_len;
+	uint8_t		mfr[COMPANY_ID_LEN + LL_FILTER_MFR_PREFIX_MAX];
+	uint8_t		uuid16[UUID16_LEN];
+	uint8_t		uuid128[UUID128_LEN];
+};
+
+static struct filter_rule rules[LL_FILTER_RULES_MAX];
+static uint8_t rules_cnt;
+
+static __inline bool uuid_in_list(const uint8_t *list, uint8_t len,
+				const uint8_t *uuid, uint8_t uuid_len)
+{
+	for (; len >= uuid_len; list += uuid_len, len -= uuid_len)
+		if (!memcmp(list, uuid, uuid_len))
+			return true;
+
+	return false;
+}
+
+/* Clear the AD conditions of the rule met by an AD structure */
+static uint8_t ad_check(const struct filter_rule *r, uint8_t pending,
+			uint8_t type, const uint8_t *data, uint8_t len)
+{
+	if ((pending & LL_FILTER_AD_TYPE) && type == r->ad_type)
+		pending &= ~LL_FILTER_AD_TYPE;
+
+	if (pending & LL_FILTER_UUID16) {
+		if (((type == AD_UUID16_INCOMPLETE ||
+				type == AD_UUID16_COMPLETE) &&
+				uuid_in_list(data, len, r->uuid16, UUID16_LEN))
+				|| (type == AD_SERVICE_DATA_UUID16 &&
+				len >= UUID16_LEN &&
+				!memcmp(data, r->uuid16, UUID16_LEN)))
+			pending &= ~LL_FILTER_UUID16;
+	}
+
+	if (pending & LL_FILTER_UUID128) {
+		if (((type == AD_UUID128_INCOMPLETE ||
+				type == AD_UUID128_COMPLETE) &&
+				uuid_in_list(data, len, r->uuid128, UUID128_LEN))
+				|| (type == AD_SERVICE_DATA_UUID128 &&
+				len >= UUID128_LEN &&
+				!memcmp(data, r->uuid128, UUID128_LEN)))
+			pending &= ~LL_FILTER_UUID128;
+	}
+
+	if ((pending & LL_FILTER_MFR) && type == AD_MFR_DATA &&
+			len >= r->mfr_len && !memcmp(data, r->mfr, r->mfr_len))
+		pending &= ~LL_FILTER_MFR;
+
+	return pending;
+}
+
+int16_t ll_filter_set(const struct ll_scan_filter_rule *rs, uint8_t n)
+{
+	const struct ll_scan_filter_rule *rule;
+	struct filter_rule *r;
+	uint8_t i, j;
+
+	if (n > LL_FILTER_RULES_MAX || (n > 0 && rs == NULL))
+		return -EINVAL;
+
+	for (i = 0; i < n; i++) {
+		if ((rs[i].fields & LL_FILTER_ADDR) &&
+				rs[i].addr_prefix_len > BDADDR_LEN)
+			return -EINVAL;
+
+		if ((rs[i].fields & LL_FILTER_MFR) &&
+				rs[i].mfr_prefix_len > LL_FILTER_MFR_PREFIX_MAX)
+			return -EINVAL;
+	}
+
+	memset(rules, 0, sizeof(rules));
+
+	for (i = 0; i < n; i++) {
+		rule = &rs[i];
+		r = &rules[i];
+
+		r->pdu_types = rule->pdu_types ? rule->pdu_types : 0xFF;
+		r->ad_conditions = rule->fields & AD_CONDITIONS;
+		r->rssi_min = (rule->fields & LL_FILTER_RSSI) ?
+						rule->rssi_min : INT8_MIN;
+
+		if (rule->fields & LL_FILTER_ADDR) {
+			r->addr_len = rule->addr_prefix_len;
+
+			/* Compared with the most significant octets */
+			for (j = 0; j < r->addr_len; j++)
+				r->addr[j] = rule->addr_prefix[r->addr_len
+								- 1 - j];
+		}
+
+		r->ad_type = rule->ad_type;
+
+		r->uuid16[0] = rule->uuid16 & 0xFF;
+		r->uuid16[1] = rule->uuid16 >> 8;
+		memcpy(r->uuid128, rule->uuid128, UUID128_LEN);
+
+		if (rule->fields & LL_FILTER_MFR) {
+			r->mfr[0] = rule->company_id & 0xFF;
+			r->mfr[1] = rule->company_id >> 8;
+			memcpy(r->mfr + COMPANY_ID_LEN, rule->mfr_prefix,
+						rule->mfr_prefix_len);
+			r->mfr_len = COMPANY_ID_LEN + rule->mfr_prefix_len;
+		}
+	}
+
+	rules_cnt = n;
+
+	return 0;
+}
+
+/* Conditions checked before the AD structures */
+static __inline bool rule_head_match(const struct filter_rule *r,
+			uint8_t pdu_type, const uint8_t *addr, int8_t rssi)
+{
+	return (r->pdu_types & LL_FILTER_PDU(pdu_type)) && rssi >= r->rssi_min
+			&& !memcmp(addr + BDADDR_LEN - r->addr_len, r->addr,
+								r->addr_len);
+}
+
+/* Called from the radio interrupt. addr is the address field of the PDU, and
+ * data the following payload. */
+bool ll_filter_match(uint8_t pdu_type, const uint8_t *addr, const uint8_t *data,
+						uint8_t len, int8_t rssi)
+{
+	uint8_t pending[LL_FILTER_RULES_MAX];
+	const struct filter_rule *r;
+	uint8_t candidates = 0;
+	uint8_t off, ad_len;
+	uint8_t i;
+
+	if (rules_cnt == 0)
+		return true;
+
+	for (i = 0; i < rules_cnt; i++) {
+		r = &rules[i];
+
+		if (!rule_head_match(r, pdu_type, addr, rssi))
+			continue;
+
+		if (r->ad_conditions == 0)
+			return true;
+
+		pending[i] = r->ad_conditions;
+		candidates |= 1 << i;
+	}
+
+	if (candidates == 0 || !(AD_PDUS & LL_FILTER_PDU(pdu_type)))
+		return false;
+
+	/* GAP specification Section 11: AD structures are Length (1 octet,
+	 * including the type), AD type and AD data */
+	for (off = 0; off + 1 < len; off += ad_len + 1) {
+		ad_len = data[off];
+
+		if (ad_len == 0 || off + 1 + ad_len > len)
+			break;
+
+		for (i = 0; i < rules_cnt; i++) {
+			if (!(candidates & (1 << i)))
+				continue;
+
+			pending[i] = ad_check(&rules[i], pending[i],
+					data[off + 1], data + off + 2,
+					ad_len - 1);
+
+			if (pending[i] == 0)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/* Called from the radio interrupt, before a SCAN_REQ is sent to the advertiser
+ * of addr. It is only worth it if the SCAN_RSP can be reported: its AD
+ * conditions are only known once received, but its type, address and RSSI
+ * (the one of the advertising PDU) already rule out most advertisers.
+ */
+bool ll_filter_scan_req(const uint8_t *addr, int8_t rssi)
+{
+	uint8_t i;
+
+	if (rules_cnt == 0)
+		return true;
+
+	for (i = 0; i < rules_cnt; i++)
+		if (rule_head_match(&rules[i], LL_PDU_SCAN_RSP, addr, rssi))
+			return true;
+
+	return false;
+}
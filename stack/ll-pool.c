@@ -0,0 +1,169 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <blessed/errcodes.h>
+#include <blessed/bdaddr.h>
+
+#include "ll.h"
+#include "ll-pool.h"
+#include "assert.h"
+
+/* Number of buffers of each pool. Must be a power of two. */
+#ifndef CONFIG_LL_POOL_TX_BUFS
+#define CONFIG_LL_POOL_TX_BUFS		8
+#endif
+
+#ifndef CONFIG_LL_POOL_RX_BUFS
+#define CONFIG_LL_POOL_RX_BUFS		8
+#endif
+
+STATIC_ASSERT(CONFIG_LL_POOL_TX_BUFS > 0 && CONFIG_LL_POOL_TX_BUFS <= 128 &&
+		!(CONFIG_LL_POOL_TX_BUFS & (CONFIG_LL_POOL_TX_BUFS - 1)));
+STATIC_ASSERT(CONFIG_LL_POOL_RX_BUFS > 0 && CONFIG_LL_POOL_RX_BUFS <= 128 &&
+		!(CONFIG_LL_POOL_RX_BUFS & (CONFIG_LL_POOL_RX_BUFS - 1)));
+
+/* The header and the largest payload of a data PDU */
+STATIC_ASSERT(LL_POOL_BUF_SIZE >= 2 + LL_DATA_MTU_PAYLOAD);
+
+/* Ring of the free buffer indexes. The indexes are free running and only
+ * wrapped when accessing the array: head - tail buffers are free.
+ */
+struct pool {
+	uint8_t			(*bufs)[LL_POOL_BUF_SIZE];
+	uint8_t			*free;
+	uint8_t			size;
+	volatile uint8_t	head;		/* ll_pool_free() */
+	volatile uint8_t	tail;		/* ll_pool_alloc() */
+	uint8_t			used_max;	/* high-water mark */
+};
+
+static uint8_t tx_bufs[CONFIG_LL_POOL_TX_BUFS][LL_POOL_BUF_SIZE]
+						__attribute__ ((aligned(4)));
+static uint8_t rx_bufs[CONFIG_LL_POOL_RX_BUFS][LL_POOL_BUF_SIZE]
+						__attribute__ ((aligned(4)));
+static uint8_t tx_free[CONFIG_LL_POOL_TX_BUFS];
+static uint8_t rx_free[CONFIG_LL_POOL_RX_BUFS];
+
+static struct pool pools[] = {
+	[LL_POOL_TX] = { tx_bufs, tx_free, CONFIG_LL_POOL_TX_BUFS },
+	[LL_POOL_RX] = { rx_bufs, rx_free, CONFIG_LL_POOL_RX_BUFS },
+};
+
+#define POOLS_NB			(sizeof(pools) / sizeof(pools[0]))
+
+/**@brief Allocate a buffer
+ *
+ * Must always be called from the same context for a given pool.
+ *
+ * @param [in] pool: LL_POOL_TX or LL_POOL_RX
+ *
+ * @return the buffer, of LL_POOL_BUF_SIZE octets, or NULL if none is free
+ */
+uint8_t *ll_pool_alloc(uint8_t pool)
+{
+	struct pool *p = &pools[pool];
+	uint8_t tail = p->tail;
+	uint8_t head = p->head;
+	uint8_t *buf;
+	uint8_t used;
+
+	if (head == tail)
+		return NULL;
+
+	__sync_synchronize();
+	buf = p->bufs[p->free[tail & (p->size - 1)]];
+
+	tail++;
+	__sync_synchronize();
+	p->tail = tail;
+
+	used = p->size - (uint8_t) (head - tail);
+	if (used > p->used_max)
+		p->used_max = used;
+
+	return buf;
+}
+
+/**@brief Free a buffer allocated with ll_pool_alloc()
+ *
+ * Must always be called from the same context for a given pool, which may be
+ * different from the context of ll_pool_alloc().
+ *
+ * @param [in] pool: the pool of the buffer
+ * @param [in] buf: the buffer
+ */
+void ll_pool_free(uint8_t pool, uint8_t *buf)
+{
+	struct pool *p = &pools[pool];
+	uint8_t head = p->head;
+
+	p->free[head & (p->size - 1)] = (buf - p->bufs[0]) / LL_POOL_BUF_SIZE;
+
+	__sync_synchronize();
+	p->head = head + 1;
+}
+
+/**@brief Get the usage of a data PDU buffer pool
+ *
+ * @param [in] pool: LL_POOL_TX or LL_POOL_RX
+ * @param [out] stats: the pool size and usage
+ *
+ * @return -EINVAL if pool is unknown or stats is NULL
+ */
+int16_t ll_get_pool_stats(uint8_t pool, struct ll_pool_stats *stats)
+{
+	struct pool *p;
+
+	if (pool >= POOLS_NB || stats == NULL)
+		return -EINVAL;
+
+	p = &pools[pool];
+	stats->size = p->size;
+	stats->used = p->size - (uint8_t) (p->head - p->tail);
+	stats->used_max = p->used_max;
+
+	return 0;
+}
+
+int16_t ll_pool_init(void)
+{
+	for (uint8_t i = 0; i < POOLS_NB; i++) {
+		struct pool *p = &pools[i];
+
+		for (uint8_t j = 0; j < p->size; j++)
+			p->free[j] = j;
+
+		p->head = p->size;
+		p->tail = 0;
+		p->used_max = 0;
+	}
+
+	return 0;
+}
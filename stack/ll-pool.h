@@ -0,0 +1,42 @@
+/**
+ *  The MIT License (MIT)
+ *
+ *  Copyright (c) 2013 Paulo B. de Oliveira Filho <pauloborgesfilho@gmail.com>
+ *  Copyright (c) 2013 Claudio Takahasi <claudio.takahasi@gmail.com>
+ *  Copyright (c) 2013 João Paulo Rechi Vita <jprvita@gmail.com>
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+ *
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+
+/* Data PDU buffer pools
+ *
+ * Each pool (LL_POOL_* in ll.h) has a fixed number of buffers, large enough
+ * for a data PDU: header and payload. The buffers of a pool are allocated in
+ * one context and freed in another one, e.g. the TX buffers are allocated by
+ * the application and freed by the radio interrupt once acknowledged, and the
+ * RX buffers the other way around. The free buffers are kept in a single
+ * producer (ll_pool_free()) single consumer (ll_pool_alloc()) ring, so both
+ * are O(1) and need no locking.
+ */
+
+#define LL_POOL_BUF_SIZE		32
+
+int16_t ll_pool_init(void);
+uint8_t *ll_pool_alloc(uint8_t pool);
+void ll_pool_free(uint8_t pool, uint8_t *buf);
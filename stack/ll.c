@@ -37,6 +37,13 @@
 #include "radio.h"
 #include "timer.h"
 #include "ll.h"
+#include "ll-conn.h"
+#include "ll-chmap.h"
+#include "ll-chsel.h"
+#include "ll-dup.h"
+#include "ll-adv-table.h"
+#include "ll-filter.h"
+#include "assert.h"
 
 /* Link Layer specification Section 2.1.2, Core 4.1 page 2503 */
 #define LL_ACCESS_ADDRESS_ADV		0x8E89BED6
@@ -44,13 +51,14 @@
 /* Link Layer specification Section 3.1.1, Core 4.1 page 2522 */
 #define LL_CRCINIT_ADV			0x555555
 
-/* The time between packets is 150 us. But we are only notified when a
- * transmission or reception is completed. So we need to consider the time to
- * receive the packet. Empirically, a SCAN_REQ roughly took 100 us to be totally
- * received, which gives us a total timeout of 250 us. But we will consider a
- * bigger window to guarantee the reception.
+/* Link Layer specification Section 4.4.2.4.2, Core 4.1 page 2531
+ * High duty cycle directed advertising: the time between the start of two
+ * consecutive ADV_DIRECT_IND PDUs sent in the same channel shall be <= 3.75 ms,
+ * and advertising shall not last more than 1.28 s.
  */
-#define T_IFS				500
+#define T_ADV_DIRECT_HIGH_INTERVAL	3750
+#define T_ADV_DIRECT_HIGH_PDU_INTERVAL	(T_ADV_DIRECT_HIGH_INTERVAL / 3)
+#define T_ADV_DIRECT_HIGH_TIMEOUT	1280000
 
 /* Link Layer specification Section 1.1, Core 4.1 page 2499 */
 typedef enum ll_states {
@@ -64,7 +72,8 @@ typedef enum ll_states {
 /* Link Layer specification Section 2.3, Core 4.1 pages 2504-2505 */
 struct __attribute__ ((packed)) ll_pdu_adv {
 	uint8_t		type:4;		/* See ll_pdu_t */
-	uint8_t		_rfu_0:2;	/* Reserved for future use */
+	uint8_t		_rfu_0:1;	/* Reserved for future use */
+	uint8_t		ch_sel:1;	/* CSA #2 supported (Core 5.0) */
 	uint8_t		tx_add:1;	/* public (0) or random (1) */
 	uint8_t		rx_add:1;	/* public (0) or random (1) */
 
@@ -80,23 +89,6 @@ struct __attribute__ ((packed)) ll_pdu_scan_req {
 	uint8_t adva[BDADDR_LEN];
 };
 
-/* Link Layer specification Section 2.3.3.1, Core 4.1 page 2509
- * CONNECT_REQ PDU payload */
-struct __attribute__ ((packed)) ll_pdu_connect_payload {
-	uint8_t		init_add[BDADDR_LEN];	/* Initiator address */
-	uint8_t		adv_add[BDADDR_LEN];	/* Advertiser address */
-	uint32_t	aa;			/* connection Access Address */
-	uint32_t	crc_init:24;		/* connection CRC init */
-	uint8_t		win_size;		/* tx window size (*1.25ms) */
-	uint16_t	win_offset;		/* tx window offset (*1.25ms) */
-	uint16_t	interval;		/* conn. interval (*1.25ms) */
-	uint16_t	latency;		/* conn. slave latency */
-	uint16_t	timeout;		/* conn. supervision (*10ms) */
-	uint64_t	ch_map:40;		/* channel map */
-	uint8_t		hop:5;			/* hop increment */
-	uint8_t		sca:3;			/* Master sleep clock accuracy */
-};
-
 static const bdaddr_t *laddr;
 static ll_states_t current_state;
 
@@ -109,78 +101,357 @@ static uint8_t adv_ch_idx;
 static uint8_t prev_adv_ch_idx;
 static uint8_t adv_ch_map;
 
-/* Link Layer specification Section 1.4, Core 4.1 page 2501 */
-#define LL_DATA_CH_NB			37
+/* Link Layer specification Section 4.3.1, Core 4.1 page 2526
+ * The white list is kept sorted, so it can be searched in O(log n) by the
+ * radio callbacks when it does not fit in the radio device address match
+ * list.
+ */
+#ifndef CONFIG_LL_WHITE_LIST_SIZE
+#define CONFIG_LL_WHITE_LIST_SIZE	32
+#endif
+
+static bdaddr_t white_list[CONFIG_LL_WHITE_LIST_SIZE];
+static uint8_t white_list_cnt;
+
+static uint8_t adv_filter_policy = LL_ADV_FILTER_NONE;
+
+/* Support of the Channel Selection Algorithm #2 (see ll-chsel.h), announced
+ * with the ChSel bit of the connectable advertising and CONNECT_REQ PDUs. It
+ * is used by the connections when both sides support it, peers without
+ * support ignore the bit (RFU before Core 5.0).
+ */
+#ifndef CONFIG_LL_CSA2
+#define CONFIG_LL_CSA2			1
+#endif
 
 /* Connection state channel map
  * Must not be modified directly, use function ll_set_data_ch_map() instead */
 static struct {
 	uint64_t mask:40;
-	uint8_t used[LL_DATA_CH_NB];
-	uint8_t cnt;
 } data_ch_map;
 
 static uint32_t t_adv_pdu_interval;
 static uint32_t t_scan_window;
 
+/* Between the start and the end of a scan (or initiating) window. Connection
+ * events may take the radio meanwhile, see conn_radio_cb(). */
+static bool scan_window_open;
+
+/* Scanning with window == interval: the radio is never stopped, it is only
+ * switched to the next channel at each interval. Switch statistics are kept
+ * relative to the beginning of the scan. */
+static bool scan_continuous;
+static uint32_t scan_switches_base;
+static uint32_t scan_dead_time_base;
+
 static struct ll_pdu_adv pdu_adv;
+static struct ll_pdu_adv pdu_adv_direct;
 static struct ll_pdu_adv pdu_scan_rsp;
+static struct ll_pdu_adv pdu_scan_req;
 static struct ll_pdu_adv pdu_connect_req;
 
-static bool rx = false;
+/* PDU sent in the current advertising events: pdu_adv or pdu_adv_direct */
+static struct ll_pdu_adv *adv_pdu = &pdu_adv;
+
+/* Remaining advertising events in high duty cycle directed advertising */
+static uint16_t adv_direct_events;
+
+/* Current advertising interval, its minimum value for the advertising PDU type
+ * and the interval to switch to at the next advertising event (or 0) */
+static uint32_t adv_interval;
+static uint32_t adv_interval_min;
+static volatile uint32_t adv_next_interval;
+
+/* Adaptive advertising interval schedule (disabled if adv_sched_steps is 0) */
+static struct ll_adv_sched_step adv_sched[LL_ADV_SCHED_STEPS_MAX];
+static uint8_t adv_sched_steps;
+static uint8_t adv_sched_flags;
+static uint8_t adv_sched_idx;
+static uint32_t adv_sched_step_events[LL_ADV_SCHED_STEPS_MAX];
+static uint32_t adv_sched_events;	/* Remaining events in the step */
+static volatile bool adv_sched_boost;
+
+/* RADIO_FLAGS_RX_NEXT to listen after each advertising PDU, and
+ * RADIO_FLAGS_TX_NEXT to answer SCAN_REQs */
+static uint32_t adv_radio_flags;
 static ll_conn_params_t ll_conn_params;
+/* A CONNECT_REQ PDU is being sent (INITIATING state) */
+static volatile bool init_connecting;
 /* Internal pointer to an array of accepted peer addresses */
 static bdaddr_t *ll_peer_addresses;
 static uint16_t ll_num_peer_addresses; /* Size of the accepted peers array */
 
 /** Timers used by the LL
- * Three timers are shared for the various states : one for triggering
+ * Two timers are shared for the various states : one for triggering
  * events at periodic intervals (advertising start / scanning start)
  *
  * The second is used as single shot : change advertising channel or stop
  * scanning at the end of the window
  *
- * The third one is used to timeout when the link layer sends a packet and
- * waits the reply after an inter frame space.
+ * Waiting for a reply after an inter frame space is timed by the radio itself
+ * (see RADIO_FLAGS_RX_NEXT).
  */
 static int16_t t_ll_interval;
 static int16_t t_ll_single_shot;
-static int16_t t_ll_ifs;
 
-static void t_ll_ifs_cb(void)
-{
-	radio_stop();
-}
+/** Callback function to refresh advertising data (ADVERTISING state) */
+static adv_data_cb_t ll_adv_data_cb = NULL;
+
+/* Number of advertising reports waiting to be delivered to the application.
+ * Must be a power of two. Each queued report keeps a radio buffer held, so
+ * this should not exceed CONFIG_RADIO_RX_BUFS - 1 by much.
+ */
+#ifndef CONFIG_LL_ADV_REPORT_QUEUE
+#define CONFIG_LL_ADV_REPORT_QUEUE	8
+#endif
+
+STATIC_ASSERT(CONFIG_LL_ADV_REPORT_QUEUE > 0 &&
+		CONFIG_LL_ADV_REPORT_QUEUE <= 128 &&
+		!(CONFIG_LL_ADV_REPORT_QUEUE & (CONFIG_LL_ADV_REPORT_QUEUE - 1)));
+
+#define ADV_REPORT_IDX(i)	((i) & (CONFIG_LL_ADV_REPORT_QUEUE - 1))
 
-/** Callback function to report advertisers (SCANNING state) */
+/** Callback functions to report advertisers (SCANNING state) */
 static adv_report_cb_t ll_adv_report_cb = NULL;
-static struct adv_report ll_adv_report;
+static adv_report_batch_cb_t ll_adv_report_batch_cb = NULL;
+
+/* Reports queue: single producer (radio interrupt, head) and single consumer
+ * (reports delivery, tail), so no locking is needed. The indexes are free
+ * running and only wrapped when accessing the array. The data of a queued
+ * report is kept in a held radio buffer until it is delivered.
+ */
+static struct adv_report adv_reports[CONFIG_LL_ADV_REPORT_QUEUE];
+static volatile uint8_t adv_reports_head;
+static volatile uint8_t adv_reports_tail;
+
+/* Reports dropped because the queue or the radio buffers were full */
+static volatile uint32_t adv_reports_overflow;
+
+/* Report PDUs received with a CRC error (SCANNING state) */
+static bool scan_crc_errors = false;
+
+/* Predictive scanning (see ll_scan_track_start()): the radio only listens
+ * around the expected advertising events of a few known advertisers */
+#ifndef CONFIG_LL_SCAN_TRACK_MAX
+#define CONFIG_LL_SCAN_TRACK_MAX	4
+#endif
+
+/* Combined clock accuracy of the advertisers and ours, in ppm */
+#ifndef CONFIG_LL_SCAN_TRACK_PPM
+#define CONFIG_LL_SCAN_TRACK_PPM	500
+#endif
+
+/* Missed events before listening continuously for the advertiser again */
+#define SCAN_TRACK_MISS_MAX		4
+
+/* Link Layer specification Section 4.4.2.2, Core 4.1 page 2528
+ * advDelay, added to each advertising interval */
+#define ADV_DELAY_MAX			10000
+
+/* Times are taken at the end of the PDUs: the windows open early enough for
+ * the radio ramp-up and the longest PDU (376 us) */
+#define SCAN_TRACK_MARGIN		600
+
+/* The windows are also checked periodically, which keeps the timer clock
+ * running while listening continuously */
+#define SCAN_TRACK_PERIOD		TIMER_SECONDS(1)
+
+/* Only the first advertising channel is listened to */
+#define SCAN_TRACK_CH			37
+
+struct scan_track {
+	bdaddr_t	addr;
+	uint32_t	interval;	/* advInterval, 0 if not known yet */
+	uint32_t	last;		/* last PDU received from it */
+	uint8_t		missed;		/* events since the last PDU */
+	bool		learn;		/* interval learned from the PDUs */
+	bool		acquiring;	/* listening continuously for it */
+};
+
+static struct scan_track scan_tracks[CONFIG_LL_SCAN_TRACK_MAX];
+static uint8_t scan_tracks_cnt;
+static bool scan_tracking;
+static bool scan_track_rx;
+
+/* Adaptive scan time allocation (see ll_set_scan_adaptive()). Each channel
+ * gets at least CONFIG_LL_SCAN_CH_FLOOR % of the scan windows, the rest is
+ * shared according to the reports yield of the channels, penalized by their
+ * CRC error rate. Windows are given by smooth weighted round robin.
+ */
+#ifndef CONFIG_LL_SCAN_CH_FLOOR
+#define CONFIG_LL_SCAN_CH_FLOOR		10
+#endif
+
+STATIC_ASSERT(CONFIG_LL_SCAN_CH_FLOOR * 3 <= 100);
+
+#define SCAN_CH_CNT			3
+
+/* Weight of the last window in the averages: 1/2^SCAN_CH_AVG_SHIFT */
+#define SCAN_CH_AVG_SHIFT		3
+
+struct scan_ch {
+	struct ll_scan_ch_stats stats;
+
+	/* Current window */
+	volatile uint16_t win_pdus;
+	volatile uint16_t win_errors;
+	volatile uint16_t win_reports;
+
+	uint16_t	yield;		/* reports per window, 1/256 */
+	uint16_t	errors;		/* CRC error ratio, 1/256 */
+	int16_t		credit;		/* weighted round robin */
+};
+
+static struct scan_ch scan_chs[SCAN_CH_CNT];
+static bool scan_adaptive;
+static bool scan_ch_window;		/* a window was started */
+
+/* Advertisers aggregation instead of reports (SCANNING state). The summaries
+ * are delivered every adv_table_period, checked at each scan interval. */
+static bool adv_table_enabled;
+static uint32_t adv_table_period;
+static uint32_t adv_table_last;
+static adv_summary_cb_t adv_summary_cb;
+static volatile bool adv_table_due;
+
+/* Link Layer specification Section 4.4.3.2, Core 4.1 page 2533
+ *
+ * Active scanning backoff procedure, to reduce SCAN_REQ collisions when there
+ * are many scanners: a SCAN_REQ is only sent after backoffCount scannable
+ * advertising PDUs. upperLimit is doubled after two consecutive failures, and
+ * halved after two consecutive successes.
+ */
+#define SCAN_UPPER_LIMIT_MAX		256
+
+static bool scan_active;
+static uint16_t scan_upper_limit;
+static uint16_t scan_backoff_count;
+static uint8_t scan_consecutive;	/* successes or failures in a row */
+static bool scan_last_success;
+
+/* A SCAN_REQ was sent, the next PDU should be the SCAN_RSP */
+static volatile bool scan_rsp_pending;
 
-static __inline void send_scan_rsp(const struct ll_pdu_adv *pdu)
+/* Check if a received SCAN_REQ is addressed to us. The SCAN_RSP is already
+ * being prepared by the radio to be sent T_IFS after the SCAN_REQ, but nothing
+ * is transmitted before the radio ramp-up is completed: this check must be done
+ * before that.
+ */
+static __inline bool is_scan_req_valid(const struct ll_pdu_adv *pdu)
 {
-	struct ll_pdu_scan_req *scn;
+	const struct ll_pdu_scan_req *scn;
 
-	/* Start replying as soon as possible, if there is something wrong,
-	 * cancel it.
-	 */
-	radio_send((const uint8_t *) &pdu_scan_rsp, 0);
+	if (pdu->type != LL_PDU_SCAN_REQ)
+		return false;
 
 	/* SCAN_REQ payload: ScanA(6 octets)|AdvA(6 octects) */
-	if (pdu->length != 12)
-		goto stop;
+	if (pdu->length != sizeof(*scn))
+		return false;
 
 	if (pdu->rx_add != laddr->type)
-		goto stop;
+		return false;
+
+	scn = (const struct ll_pdu_scan_req *) pdu->payload;
+
+	return !memcmp(scn->adva, laddr->addr, BDADDR_LEN);
+}
 
-	scn = (struct ll_pdu_scan_req *) pdu->payload;
+/* Check if a received CONNECT_REQ answers our connectable advertising PDU. It
+ * has to come from the peer device in directed advertising.
+ */
+static __inline bool is_connect_req_valid(const struct ll_pdu_adv *pdu)
+{
+	const struct ll_pdu_connect_payload *req;
 
-	if (memcmp(scn->adva, laddr->addr, 6))
-		goto stop;
+	if (pdu->type != LL_PDU_CONNECT_REQ)
+		return false;
 
-	return;
+	if (pdu->length != sizeof(*req))
+		return false;
 
-stop:
-	radio_stop();
+	if (adv_pdu->type != LL_PDU_ADV_IND
+				&& adv_pdu->type != LL_PDU_ADV_DIRECT_IND)
+		return false;
+
+	if (pdu->rx_add != laddr->type)
+		return false;
+
+	req = (const struct ll_pdu_connect_payload *) pdu->payload;
+
+	if (memcmp(req->adv_add, laddr->addr, BDADDR_LEN))
+		return false;
+
+	if (adv_pdu->type == LL_PDU_ADV_IND)
+		return true;
+
+	return pdu->tx_add == pdu_adv_direct.rx_add
+			&& !memcmp(req->init_add,
+				pdu_adv_direct.payload + BDADDR_LEN, BDADDR_LEN);
+}
+
+static __inline int16_t bdaddr_cmp(uint8_t type, const uint8_t *addr,
+							const bdaddr_t *b)
+{
+	if (type != b->type)
+		return type < b->type ? -1 : 1;
+
+	return memcmp(addr, b->addr, BDADDR_LEN);
+}
+
+/* Binary search in the white list. Returns the index of the address if found,
+ * or -(insertion index) - 1 otherwise.
+ */
+static int16_t white_list_search(uint8_t type, const uint8_t *addr)
+{
+	int16_t lo = 0;
+	int16_t hi = white_list_cnt - 1;
+	int16_t mid, cmp;
+
+	while (lo <= hi) {
+		mid = (lo + hi) >> 1;
+		cmp = bdaddr_cmp(type, addr, &white_list[mid]);
+
+		if (cmp == 0)
+			return mid;
+		else if (cmp < 0)
+			hi = mid - 1;
+		else
+			lo = mid + 1;
+	}
+
+	return -lo - 1;
+}
+
+static __inline bool is_white_list_in_hw(void)
+{
+	return white_list_cnt <= RADIO_DEV_MATCH_MAX;
+}
+
+/* Load the white list in the radio device address match list, if it fits */
+static void white_list_load_hw(void)
+{
+	radio_clear_dev_match();
+
+	if (!is_white_list_in_hw())
+		return;
+
+	for (uint8_t i = 0; i < white_list_cnt; i++)
+		radio_set_dev_match(i, white_list[i].addr, white_list[i].type);
+}
+
+/* Check if the sender of a SCAN_REQ or a CONNECT_REQ (ScanA or InitA, the first
+ * field of the payload) passes the advertising filter policy
+ */
+static __inline bool is_req_allowed(const struct ll_pdu_adv *pdu,
+								uint8_t filter)
+{
+	if (!(adv_filter_policy & filter))
+		return true;
+
+	if (is_white_list_in_hw())
+		return radio_dev_matched();
+
+	return white_list_search(pdu->tx_add, pdu->payload) >= 0;
 }
 
 /* Check if the specified address is in the accepted peer addresses */
@@ -242,24 +513,53 @@ static __inline int16_t inc_adv_ch_idx(void)
 	return 0;
 }
 
+/* Link Layer specification Section 4.4.2, Core 4.1 page 2528
+ * Enter the Connection state as slave. The connection timer is started before
+ * the advertising timers are stopped, to keep the timestamps running.
+ */
+static void adv_connect(const struct ll_pdu_adv *pdu)
+{
+	const struct ll_pdu_connect_payload *req;
+
+	req = (const struct ll_pdu_connect_payload *) pdu->payload;
+	if (ll_conn_slave_start(req, pdu->tx_add, radio_get_end_time(),
+					adv_pdu->ch_sel && pdu->ch_sel) < 0)
+		return;
+
+	timer_stop(t_ll_interval);
+	timer_stop(t_ll_single_shot);
+
+	current_state = LL_STATE_CONNECTION;
+}
+
 static void adv_radio_recv_cb(const uint8_t *pdu, bool crc, bool active)
 {
 	struct ll_pdu_adv *rcvd_pdu = (struct ll_pdu_adv*) pdu;
 
-	if (pdu_adv.type != LL_PDU_ADV_IND &&
-					pdu_adv.type != LL_PDU_ADV_SCAN_IND)
+	/* The filter policy is ignored for directed advertising */
+	if (crc && is_connect_req_valid(rcvd_pdu) &&
+				(adv_pdu == &pdu_adv_direct ||
+				is_req_allowed(rcvd_pdu, LL_ADV_FILTER_CONN))) {
+		/* Cancel the SCAN_RSP */
+		if (active)
+			radio_stop();
+
+		adv_connect(rcvd_pdu);
 		return;
+	}
 
-	if (rcvd_pdu->type != LL_PDU_SCAN_REQ)
+	/* The SCAN_RSP is sent T_IFS after the SCAN_REQ, unless cancelled */
+	if (!active)
 		return;
 
-	timer_stop(t_ll_ifs);
-	send_scan_rsp(rcvd_pdu);
-}
+	if (!crc || !is_scan_req_valid(rcvd_pdu) ||
+			!is_req_allowed(rcvd_pdu, LL_ADV_FILTER_SCAN)) {
+		radio_stop();
+		return;
+	}
 
-static void adv_radio_send_cb(bool active)
-{
-	timer_start(t_ll_ifs, T_IFS, t_ll_ifs_cb);
+	if (adv_sched_flags & LL_ADV_SCHED_BOOST_SCAN_REQ)
+		adv_sched_boost = true;
 }
 
 static void adv_singleshot_cb(void)
@@ -267,7 +567,7 @@ static void adv_singleshot_cb(void)
 	radio_stop();
 	radio_prepare(adv_chs[adv_ch_idx], LL_ACCESS_ADDRESS_ADV,
 								LL_CRCINIT_ADV);
-	radio_send((uint8_t *) &pdu_adv, rx ? RADIO_FLAGS_RX_NEXT : 0);
+	radio_send((uint8_t *) adv_pdu, adv_radio_flags);
 
 	prev_adv_ch_idx = adv_ch_idx;
 	if (!inc_adv_ch_idx())
@@ -275,8 +575,87 @@ static void adv_singleshot_cb(void)
 							adv_singleshot_cb);
 }
 
+static __inline void update_adv_data(void)
+{
+	uint8_t len;
+
+	/* ADV_DIRECT_IND PDUs have no AdvData field */
+	if (!ll_adv_data_cb || adv_pdu != &pdu_adv)
+		return;
+
+	len = ll_adv_data_cb(pdu_adv.payload + BDADDR_LEN,
+						pdu_adv.length - BDADDR_LEN);
+
+	/* Keep the previous length if the application messed up */
+	if (len > LL_ADV_MTU_DATA)
+		return;
+
+	pdu_adv.length = BDADDR_LEN + len;
+}
+
+static __inline bool is_adv_interval_valid(uint32_t interval)
+{
+	return !(interval % LL_ADV_INTERVAL_QUANTUM)
+					&& interval >= adv_interval_min
+					&& interval <= LL_ADV_INTERVAL_MAX;
+}
+
+static void adv_sched_enter_step(uint8_t idx)
+{
+	const struct ll_adv_sched_step *step = &adv_sched[idx];
+
+	adv_sched_idx = idx;
+	adv_sched_events = adv_sched_step_events[idx];
+
+	if (step->interval != adv_interval)
+		adv_next_interval = step->interval;
+}
+
+/* Called at each advertising event to follow the schedule */
+static __inline void adv_sched_update(void)
+{
+	if (!adv_sched_steps || adv_direct_events > 0)
+		return;
+
+	if (adv_sched_boost) {
+		adv_sched_boost = false;
+		adv_sched_enter_step(0);
+	}
+
+	/* The current step lasts forever */
+	if (!adv_sched[adv_sched_idx].duration)
+		return;
+
+	if (--adv_sched_events == 0 && adv_sched_idx + 1 < adv_sched_steps)
+		adv_sched_enter_step(adv_sched_idx + 1);
+}
+
 static void adv_interval_cb(void)
 {
+	uint32_t interval;
+
+	if (adv_direct_events > 0 && --adv_direct_events == 0) {
+		DBG("High duty cycle directed advertising timeout");
+		ll_advertise_stop();
+		return;
+	}
+
+	adv_sched_update();
+
+	/* Switch the interval at the event boundary: this event becomes the
+	 * first event of the new interval.
+	 */
+	interval = adv_next_interval;
+	if (interval) {
+		adv_next_interval = 0;
+		adv_interval = interval;
+
+		timer_stop(t_ll_interval);
+		timer_start(t_ll_interval, interval, adv_interval_cb);
+	}
+
+	update_adv_data();
+
 	adv_ch_idx = first_adv_ch_idx();
 	adv_singleshot_cb();
 }
@@ -284,7 +663,7 @@ static void adv_interval_cb(void)
 int16_t ll_advertise_start(ll_pdu_t type, uint32_t interval, uint8_t chmap)
 {
 	radio_recv_cb_t recv_cb;
-	radio_send_cb_t send_cb;
+	uint32_t interval_min;
 	int16_t err_code;
 
 	if (current_state != LL_STATE_STANDBY)
@@ -296,40 +675,97 @@ int16_t ll_advertise_start(ll_pdu_t type, uint32_t interval, uint8_t chmap)
 	if (interval % LL_ADV_INTERVAL_QUANTUM)
 		return -EINVAL;
 
-	if (interval < LL_ADV_INTERVAL_MIN_NONCONN
-					|| interval > LL_ADV_INTERVAL_MAX)
-			return -EINVAL;
-
 	adv_ch_map = chmap;
+	adv_pdu = &pdu_adv;
+	adv_direct_events = 0;
+	t_adv_pdu_interval = TIMER_MILLIS(10); /* <= 10ms Sec 4.4.2.6 */
 
 	switch (type) {
+	case LL_PDU_ADV_DIRECT_IND:
+		adv_pdu = &pdu_adv_direct;
+
+		if (interval == LL_ADV_INTERVAL_DIRECT_HIGH) {
+			interval = T_ADV_DIRECT_HIGH_INTERVAL;
+			t_adv_pdu_interval = T_ADV_DIRECT_HIGH_PDU_INTERVAL;
+
+			/* The first event is started below, hence the + 1 */
+			adv_direct_events = T_ADV_DIRECT_HIGH_TIMEOUT
+					/ T_ADV_DIRECT_HIGH_INTERVAL + 1;
+		}
+
+		interval_min = LL_ADV_INTERVAL_MIN_CONN;
+		recv_cb = adv_radio_recv_cb;
+		adv_radio_flags = RADIO_FLAGS_RX_NEXT;
+		break;
+
 	case LL_PDU_ADV_IND:
+		interval_min = LL_ADV_INTERVAL_MIN_CONN;
+		recv_cb = adv_radio_recv_cb;
+		adv_radio_flags = RADIO_FLAGS_RX_NEXT | RADIO_FLAGS_TX_NEXT;
+		break;
+
 	case LL_PDU_ADV_SCAN_IND:
+		interval_min = LL_ADV_INTERVAL_MIN_SCAN;
 		recv_cb = adv_radio_recv_cb;
-		send_cb = adv_radio_send_cb;
-		rx = true;
+		adv_radio_flags = RADIO_FLAGS_RX_NEXT | RADIO_FLAGS_TX_NEXT;
 		break;
 
 	case LL_PDU_ADV_NONCONN_IND:
+		interval_min = LL_ADV_INTERVAL_MIN_NONCONN;
 		recv_cb = NULL;
-		send_cb = NULL;
-		rx = false;
+		adv_radio_flags = 0;
 		break;
 
-	case LL_PDU_ADV_DIRECT_IND:
-		/* TODO: Not implemented */
 	default:
 		/* Invalid PDU */
 		return -EINVAL;
 	}
 
-	pdu_adv.type = type;
-	t_adv_pdu_interval = TIMER_MILLIS(10); /* <= 10ms Sec 4.4.2.6 */
+	adv_interval_min = interval_min;
+	adv_next_interval = 0;
+	adv_sched_boost = false;
+
+	if (adv_direct_events > 0) {
+		/* High duty cycle directed advertising has fixed timings */
+	} else if (adv_sched_steps) {
+		for (uint8_t i = 0; i < adv_sched_steps; i++) {
+			if (!is_adv_interval_valid(adv_sched[i].interval))
+				return -EINVAL;
+		}
+
+		interval = adv_sched[0].interval;
+	} else if (!is_adv_interval_valid(interval)) {
+		return -EINVAL;
+	}
+
+	adv_interval = interval;
+
+	/* Link Layer specification Section 4.3.2, Core 4.1 page 2527
+	 * The filter policy is ignored for directed advertising. When all the
+	 * requests accepted by the PDU type are filtered, unknown devices are
+	 * dropped by the radio itself.
+	 */
+	if (type != LL_PDU_ADV_DIRECT_IND &&
+				adv_filter_policy != LL_ADV_FILTER_NONE) {
+		white_list_load_hw();
+
+		if (is_white_list_in_hw() && ((type == LL_PDU_ADV_SCAN_IND &&
+				(adv_filter_policy & LL_ADV_FILTER_SCAN)) ||
+				adv_filter_policy == LL_ADV_FILTER_BOTH))
+			adv_radio_flags |= RADIO_FLAGS_DEV_MATCH;
+	}
 
-	radio_set_callbacks(recv_cb, send_cb);
+	adv_pdu->type = type;
+	adv_pdu->ch_sel = CONFIG_LL_CSA2 && type != LL_PDU_ADV_SCAN_IND
+					&& type != LL_PDU_ADV_NONCONN_IND;
 
-	DBG("PDU interval %u ms, event interval %u ms",
-				t_adv_pdu_interval / 1000, interval / 1000);
+	radio_set_callbacks(recv_cb, NULL);
+	radio_set_timeout_cb(NULL);
+	radio_set_out_buffer((uint8_t *) &pdu_scan_rsp);
+
+	DBG("PDU interval %u ms, event interval %u ms%s",
+				t_adv_pdu_interval / 1000, interval / 1000,
+				adv_sched_steps ? " (scheduled)" : "");
 
 	err_code = timer_start(t_ll_interval, interval, adv_interval_cb);
 	if (err_code < 0)
@@ -337,11 +773,104 @@ int16_t ll_advertise_start(ll_pdu_t type, uint32_t interval, uint8_t chmap)
 
 	current_state = LL_STATE_ADVERTISING;
 
+	if (adv_sched_steps && adv_direct_events == 0) {
+		adv_sched_enter_step(0);
+
+		/* The first event is started below */
+		adv_sched_events++;
+	}
+
 	adv_interval_cb();
 
 	return 0;
 }
 
+/**@brief Change the advertising interval without leaving the advertising state
+ *
+ * The new interval takes effect at the next advertising event. If an adaptive
+ * schedule is in use, it will override the interval at its next step.
+ *
+ * @param [in] interval: the new advertising interval in us
+ */
+int16_t ll_set_advertising_interval(uint32_t interval)
+{
+	if (current_state != LL_STATE_ADVERTISING)
+		return -ENOREADY;
+
+	if (adv_direct_events > 0 || !is_adv_interval_valid(interval))
+		return -EINVAL;
+
+	adv_next_interval = interval;
+
+	return 0;
+}
+
+/**@brief Set an adaptive advertising interval schedule
+ *
+ * When a schedule is set, ll_advertise_start() ignores its interval argument
+ * and advertises using each step's interval for the step's duration, then moves
+ * to the next step. The last step lasts forever, as well as any step with a
+ * duration of 0. Steps are switched at advertising event boundaries, without
+ * leaving the advertising state.
+ *
+ * A typical schedule uses a fast interval (e.g. 20-30 ms) for a discovery
+ * period and then a slow interval to save power.
+ *
+ * @param [in] steps: the steps of the schedule
+ * @param [in] nsteps: the number of steps (up to LL_ADV_SCHED_STEPS_MAX), 0 to
+ * 	disable the schedule
+ * @param [in] flags: LL_ADV_SCHED_BOOST_SCAN_REQ to go back to the first step
+ * 	when a SCAN_REQ is answered
+ */
+int16_t ll_set_advertising_schedule(const struct ll_adv_sched_step *steps,
+						uint8_t nsteps, uint8_t flags)
+{
+	if (current_state != LL_STATE_STANDBY)
+		return -EBUSY;
+
+	if (nsteps > LL_ADV_SCHED_STEPS_MAX || (nsteps && steps == NULL))
+		return -EINVAL;
+
+	for (uint8_t i = 0; i < nsteps; i++) {
+		if (!steps[i].interval)
+			return -EINVAL;
+	}
+
+	memcpy(adv_sched, steps, nsteps * sizeof(adv_sched[0]));
+
+	/* Events of each step, counted down at each event: at least one,
+	 * unless the step lasts forever */
+	for (uint8_t i = 0; i < nsteps; i++) {
+		adv_sched_step_events[i] = steps[i].duration
+							/ steps[i].interval;
+		if (steps[i].duration && !adv_sched_step_events[i])
+			adv_sched_step_events[i] = 1;
+	}
+
+	adv_sched_steps = nsteps;
+	adv_sched_flags = flags;
+
+	return 0;
+}
+
+/**@brief Go back to the first step of the advertising schedule
+ *
+ * To be called when the application knows that a central is interested in
+ * the device (e.g. after a disconnection).
+ */
+int16_t ll_advertise_boost(void)
+{
+	if (current_state != LL_STATE_ADVERTISING)
+		return -ENOREADY;
+
+	if (!adv_sched_steps)
+		return -EINVAL;
+
+	adv_sched_boost = true;
+
+	return 0;
+}
+
 int16_t ll_advertise_stop()
 {
 	int16_t err_code;
@@ -349,210 +878,1047 @@ int16_t ll_advertise_stop()
 	if (current_state != LL_STATE_ADVERTISING)
 		return -ENOREADY;
 
-	timer_stop(t_ll_ifs);
-
 	err_code = timer_stop(t_ll_interval);
 	if (err_code < 0)
 		return err_code;
 
-	err_code = timer_stop(t_ll_single_shot);
-	if (err_code < 0)
-		return err_code;
+	/* The single shot timer is not active between advertising events */
+	timer_stop(t_ll_single_shot);
+
+	radio_stop();
 
 	current_state = LL_STATE_STANDBY;
 
-	return 0;
+	return 0;
+}
+
+int16_t ll_set_advertising_data(const uint8_t *data, uint8_t len)
+{
+	if (current_state != LL_STATE_STANDBY)
+		return -EBUSY;
+
+	if (data == NULL)
+		return -EINVAL;
+
+	if (len > LL_ADV_MTU_DATA)
+		return -EINVAL;
+
+	memcpy(pdu_adv.payload + sizeof(laddr->addr), data, len);
+	pdu_adv.length = sizeof(laddr->addr) + len;
+
+	return 0;
+}
+
+int16_t ll_set_scan_response_data(const uint8_t *data, uint8_t len)
+{
+	if (data == NULL)
+		return -EINVAL;
+
+	if (len > LL_ADV_MTU_DATA)
+		return -EINVAL;
+
+	memcpy(pdu_scan_rsp.payload + sizeof(laddr->addr), data, len);
+	pdu_scan_rsp.length = sizeof(laddr->addr) + len;
+
+	return 0;
+}
+
+/**@brief Set a callback to refresh the advertising data in place before every
+ * advertising event
+ *
+ * The callback writes directly into the outgoing PDU buffer, so fresh data
+ * (sensor readings, counters, battery level) can be broadcast without any copy.
+ * The data set by ll_set_advertising_data() is used as initial content.
+ *
+ * @param [in] adv_data_cb: the callback function, or NULL to disable it
+ */
+int16_t ll_set_advertising_data_cb(adv_data_cb_t adv_data_cb)
+{
+	ll_adv_data_cb = adv_data_cb;
+
+	return 0;
+}
+
+/**@brief Set the address of the initiator targeted by directed advertising
+ *
+ * @param [in] addr: the address to be put in the InitA field of ADV_DIRECT_IND
+ * 	PDUs
+ */
+int16_t ll_set_direct_address(const bdaddr_t *addr)
+{
+	if (current_state != LL_STATE_STANDBY)
+		return -EBUSY;
+
+	if (addr == NULL)
+		return -EINVAL;
+
+	/* ADV_DIRECT_IND payload: AdvA(6 octets)|InitA(6 octets) */
+	pdu_adv_direct.rx_add = addr->type;
+	memcpy(pdu_adv_direct.payload + BDADDR_LEN, addr->addr, BDADDR_LEN);
+
+	return 0;
+}
+
+/**@brief Set the advertising filter policy
+ *
+ * @param [in] policy: LL_ADV_FILTER_NONE, LL_ADV_FILTER_SCAN,
+ * 	LL_ADV_FILTER_CONN or LL_ADV_FILTER_BOTH
+ */
+int16_t ll_set_adv_filter_policy(uint8_t policy)
+{
+	if (current_state != LL_STATE_STANDBY)
+		return -EBUSY;
+
+	if (policy & ~LL_ADV_FILTER_BOTH)
+		return -EINVAL;
+
+	adv_filter_policy = policy;
+
+	return 0;
+}
+
+/**@brief Add a device to the white list
+ *
+ * Up to RADIO_DEV_MATCH_MAX devices, the white list is matched by the radio
+ * hardware. Bigger lists are searched by software.
+ */
+int16_t ll_white_list_add(const bdaddr_t *addr)
+{
+	int16_t idx;
+
+	if (current_state != LL_STATE_STANDBY)
+		return -EBUSY;
+
+	if (addr == NULL)
+		return -EINVAL;
+
+	idx = white_list_search(addr->type, addr->addr);
+	if (idx >= 0)
+		return -EALREADY;
+
+	if (white_list_cnt == CONFIG_LL_WHITE_LIST_SIZE)
+		return -ENOMEM;
+
+	idx = -idx - 1;
+	memmove(&white_list[idx + 1], &white_list[idx],
+			(white_list_cnt - idx) * sizeof(white_list[0]));
+	white_list[idx] = *addr;
+	white_list_cnt++;
+
+	return 0;
+}
+
+/**@brief Remove a device from the white list
+ */
+int16_t ll_white_list_remove(const bdaddr_t *addr)
+{
+	int16_t idx;
+
+	if (current_state != LL_STATE_STANDBY)
+		return -EBUSY;
+
+	if (addr == NULL)
+		return -EINVAL;
+
+	idx = white_list_search(addr->type, addr->addr);
+	if (idx < 0)
+		return -EINVAL;
+
+	white_list_cnt--;
+	memmove(&white_list[idx], &white_list[idx + 1],
+			(white_list_cnt - idx) * sizeof(white_list[0]));
+
+	return 0;
+}
+
+/**@brief Remove all the devices from the white list
+ */
+int16_t ll_white_list_clear(void)
+{
+	if (current_state != LL_STATE_STANDBY)
+		return -EBUSY;
+
+	white_list_cnt = 0;
+
+	return 0;
+}
+
+static void init_adv_pdus(void)
+{
+	pdu_adv.tx_add = laddr->type;
+	memcpy(pdu_adv.payload, laddr->addr, sizeof(laddr->addr));
+
+	ll_set_advertising_data(NULL, 0);
+
+	pdu_adv_direct.type = LL_PDU_ADV_DIRECT_IND;
+	pdu_adv_direct.tx_add = laddr->type;
+	pdu_adv_direct.length = 2 * BDADDR_LEN;
+	memcpy(pdu_adv_direct.payload, laddr->addr, sizeof(laddr->addr));
+
+	pdu_scan_req.type = LL_PDU_SCAN_REQ;
+	pdu_scan_req.tx_add = laddr->type;
+	pdu_scan_req.length = 2 * BDADDR_LEN;
+	memcpy(pdu_scan_req.payload, laddr->addr, sizeof(laddr->addr));
+
+	pdu_scan_rsp.type = LL_PDU_SCAN_RSP;
+	pdu_scan_rsp.tx_add = laddr->type;
+	memcpy(pdu_scan_rsp.payload, laddr->addr, sizeof(laddr->addr));
+
+	ll_set_scan_response_data(NULL, 0);
+}
+
+/* The last connection was closed */
+static void conn_idle_cb(void)
+{
+	if (current_state == LL_STATE_CONNECTION)
+		current_state = LL_STATE_STANDBY;
+}
+
+/* State when scanning or initiating ends */
+static __inline ll_states_t idle_state(void)
+{
+	return ll_conn_count() ? LL_STATE_CONNECTION : LL_STATE_STANDBY;
+}
+
+static void scan_resume(void);
+static void init_resume(void);
+
+/* Connection events take the radio from scanning and initiating. A SCAN_REQ or
+ * CONNECT_REQ exchange in progress is dropped, and the reception is resumed at
+ * the end of the event if the window is still open.
+ */
+static void conn_radio_cb(bool taken)
+{
+	if (taken) {
+		scan_rsp_pending = false;
+
+		/* The initiating window ended with the CONNECT_REQ */
+		if (init_connecting) {
+			init_connecting = false;
+			scan_window_open = false;
+		}
+
+		return;
+	}
+
+	if (current_state == LL_STATE_SCANNING)
+		scan_resume();
+	else if (current_state == LL_STATE_INITIATING)
+		init_resume();
+}
+
+static void init_default_conn_params(void)
+{
+	ll_conn_params.conn_interval_min	= 16; /* 20 ms */
+	ll_conn_params.conn_interval_max 	= 160; /* 200 ms */
+	ll_conn_params.conn_latency 		= 0;
+	ll_conn_params.supervision_timeout	= 100; /* 1s */
+	ll_conn_params.minimum_ce_length	= 0;
+	ll_conn_params.maximum_ce_length	= 16; /* 10 ms */
+
+	ll_set_data_ch_map(LL_DATA_CH_ALL);
+}
+
+/**@brief At the beginning of a new connection, prepare the CONNECT_REQ PDU to
+ * send
+ *
+ * See Link Layer specification Section 4.5, Core 4.1 pages 2537-2547
+ */
+static void init_connect_req_pdu()
+{
+	struct ll_pdu_connect_payload *payload;
+	uint16_t interval;
+
+	pdu_connect_req.type = LL_PDU_CONNECT_REQ;
+	pdu_connect_req.tx_add = laddr->type;
+	pdu_connect_req.length = sizeof(*payload);
+
+	payload = (struct ll_pdu_connect_payload*)(pdu_connect_req.payload);
+	memcpy(payload->init_add, laddr->addr, BDADDR_LEN);
+
+	payload->aa = generate_access_address();
+	payload->crc_init = 0;
+	for (int i = 0; i < 3; i++)
+		payload->crc_init |= (random_generate() << (8*i));
+
+	/* The interval is chosen, and the first anchor point placed, so that
+	 * the events of the master connections do not overlap. The offset of
+	 * the transmit window is set when the CONNECT_REQ is sent (see
+	 * ll_conn_plan_offset()).
+	 */
+	ll_conn_plan(&ll_conn_params, data_ch_map.mask, &interval);
+	payload->interval = interval;
+	payload->win_size = 2;
+	payload->win_offset = 0;
+
+	payload->latency = ll_conn_params.conn_latency;
+	payload->timeout = ll_conn_params.supervision_timeout;
+	payload->ch_map = ll_chmap_filter(data_ch_map.mask);
+
+	/* "Random" value between 5 and 16 */
+	payload->hop = (random_generate() % 12) + 5;
+	payload->sca = ll_conn_sca();
+
+}
+
+int16_t ll_init(const bdaddr_t *addr)
+{
+	int16_t err_code;
+
+	if (addr == NULL)
+		return -EINVAL;
+
+	err_code = ll_plat_init();
+	if (err_code < 0)
+		return err_code;
+
+	err_code = log_init();
+	if (err_code < 0 && err_code != -EALREADY)
+		return err_code;
+
+	err_code = timer_init();
+	if (err_code < 0)
+		return err_code;
+
+	err_code = radio_init();
+	if (err_code < 0)
+		return err_code;
+
+	err_code = random_init();
+	if (err_code < 0)
+		return err_code;
+
+	t_ll_interval = timer_create(TIMER_REPEATED);
+	if (t_ll_interval < 0)
+		return t_ll_interval;
+
+	t_ll_single_shot = timer_create(TIMER_SINGLESHOT);
+	if (t_ll_single_shot < 0)
+		return t_ll_single_shot;
+
+	err_code = ll_conn_init(conn_idle_cb, conn_radio_cb);
+	if (err_code < 0)
+		return err_code;
+
+	laddr = addr;
+	current_state = LL_STATE_STANDBY;
+
+	init_adv_pdus();
+	init_default_conn_params();
+
+	return 0;
+}
+
+static void scan_backoff_reset(void)
+{
+	scan_upper_limit = 1;
+	scan_backoff_count = 1;
+	scan_consecutive = 0;
+	scan_rsp_pending = false;
+}
+
+static void scan_backoff_update(bool success)
+{
+	if (scan_consecutive == 0 || success != scan_last_success) {
+		scan_last_success = success;
+		scan_consecutive = 1;
+	} else if (++scan_consecutive == 2) {
+		scan_consecutive = 0;
+
+		if (success && scan_upper_limit > 1)
+			scan_upper_limit /= 2;
+		else if (!success && scan_upper_limit < SCAN_UPPER_LIMIT_MAX)
+			scan_upper_limit *= 2;
+	}
+
+	scan_backoff_count = (random_generate() % scan_upper_limit) + 1;
+}
+
+/* Decide if a SCAN_REQ is sent for a received PDU. The SCAN_REQ is already
+ * being prepared by the radio (RADIO_FLAGS_TX_NEXT), its AdvA is filled here.
+ */
+static bool scan_req_prepare(const struct ll_pdu_adv *pdu, bool crc)
+{
+	if (!crc || pdu->length < BDADDR_LEN)
+		return false;
+
+	if (pdu->type != LL_PDU_ADV_IND && pdu->type != LL_PDU_ADV_SCAN_IND)
+		return false;
+
+	/* No SCAN_REQ, nor backoff step, for a SCAN_RSP that would be
+	 * filtered out */
+	if (!ll_filter_scan_req(pdu->payload, radio_get_rssi()))
+		return false;
+
+	if (--scan_backoff_count > 0)
+		return false;
+
+	pdu_scan_req.rx_add = pdu->tx_add;
+	memcpy(pdu_scan_req.payload + BDADDR_LEN, pdu->payload, BDADDR_LEN);
+
+	return true;
+}
+
+static bool is_scan_rsp_valid(const struct ll_pdu_adv *pdu, bool crc)
+{
+	return crc && pdu->type == LL_PDU_SCAN_RSP
+			&& pdu->length >= BDADDR_LEN
+			&& pdu->tx_add == pdu_scan_req.rx_add
+			&& !memcmp(pdu->payload, pdu_scan_req.payload + BDADDR_LEN,
+								BDADDR_LEN);
+}
+
+static __inline uint32_t scan_radio_flags(void)
+{
+	return scan_active ? RADIO_FLAGS_RX_NEXT | RADIO_FLAGS_TX_NEXT : 0;
+}
+
+static void scan_radio_timeout_cb(void)
+{
+	/* No SCAN_RSP T_IFS after the SCAN_REQ */
+	scan_rsp_pending = false;
+	scan_backoff_update(false);
+
+	radio_recv(scan_radio_flags());
+}
+
+static void scan_report(const uint8_t *pdu, bool crc, uint32_t timestamp)
+{
+	struct ll_pdu_adv *rcvd_pdu = (struct ll_pdu_adv*) pdu;
+	struct adv_report *report;
+	uint8_t head = adv_reports_head;
+
+	struct scan_ch *ch = &scan_chs[radio_get_rx_channel()
+							- adv_chs[0]];
+
+	if (crc)
+		ch->win_pdus++;
+	else
+		ch->win_errors++;
+
+	/* A corrupted length would make the report point out of the PDU */
+	if ((!crc && !scan_crc_errors) || rcvd_pdu->length < BDADDR_LEN
+				|| rcvd_pdu->length > LL_ADV_MTU_PAYLOAD)
+		return;
+
+	if (!ll_filter_match(rcvd_pdu->type, rcvd_pdu->payload,
+				rcvd_pdu->payload + BDADDR_LEN,
+				rcvd_pdu->length - BDADDR_LEN,
+				radio_get_rssi()))
+		return;
+
+	if (adv_table_enabled) {
+		ch->win_reports++;
+
+		if (crc)
+			ll_adv_table_update(rcvd_pdu->type, rcvd_pdu->tx_add,
+					rcvd_pdu->payload,
+					rcvd_pdu->payload + BDADDR_LEN,
+					rcvd_pdu->length - BDADDR_LEN,
+					radio_get_rssi(),
+					radio_get_rx_channel(),
+					timestamp);
+		return;
+	}
+
+	if (!ll_adv_report_cb && !ll_adv_report_batch_cb) {
+		ERROR("No adv. report callback defined");
+		return;
+	}
+
+	/* PDUs with a CRC error are not trusted to identify the device */
+	if (crc && ll_dup_check(rcvd_pdu->type, rcvd_pdu->tx_add,
+				rcvd_pdu->payload, rcvd_pdu->payload + BDADDR_LEN,
+				rcvd_pdu->length - BDADDR_LEN, timestamp))
+		return;
+
+	/* The report points to the PDU inside the radio buffer, which must be
+	 * kept until the report is delivered.
+	 */
+	ch->win_reports++;
+
+	if ((uint8_t) (head - adv_reports_tail) == CONFIG_LL_ADV_REPORT_QUEUE
+					|| radio_hold_buf(pdu) < 0) {
+		adv_reports_overflow++;
+		return;
+	}
+
+	report = &adv_reports[ADV_REPORT_IDX(head)];
+	*report = (struct adv_report) {
+		.type = rcvd_pdu->type,
+		.addr = { .type = rcvd_pdu->tx_add },
+		.data = rcvd_pdu->payload + BDADDR_LEN,
+		.len = rcvd_pdu->length - BDADDR_LEN,
+		.rssi = radio_get_rssi(),
+		.channel = radio_get_rx_channel(),
+		.crc_ok = crc,
+		.timestamp = timestamp
+	};
+
+	memcpy(report->addr.addr, rcvd_pdu->payload, BDADDR_LEN);
+
+	/* The report must be complete before it is published */
+	__sync_synchronize();
+	adv_reports_head = head + 1;
+
+	ll_plat_signal_adv_reports();
+}
+
+/* Window of the next expected event of a tracked advertiser. After missed
+ * events, the window is widened by advDelay of each of them, and the clock
+ * drift grows with the time since the last PDU. */
+static void scan_track_window(const struct scan_track *t, uint32_t *open,
+								uint32_t *close)
+{
+	uint32_t events = t->missed + 1;
+	uint32_t elapsed = events * (t->interval + ADV_DELAY_MAX);
+	uint32_t drift = ((uint64_t) elapsed * CONFIG_LL_SCAN_TRACK_PPM)
+								/ 1000000;
+
+	*open = t->last + events * t->interval - drift - SCAN_TRACK_MARGIN;
+	*close = t->last + elapsed + drift;
+}
+
+/* Turn the radio on or off according to the windows of the advertisers, and
+ * program the single shot timer to the next change */
+static void scan_track_update(void)
+{
+	uint32_t now = timer_get_timestamp();
+	uint32_t open, close, next = 0;
+	struct scan_track *t;
+	bool rx = false;
+	bool wake = false;
+	uint8_t i;
+
+	for (i = 0; i < scan_tracks_cnt; i++) {
+		t = &scan_tracks[i];
+
+		if (t->acquiring) {
+			rx = true;
+			continue;
+		}
+
+		scan_track_window(t, &open, &close);
+
+		while (!TIMER_BEFORE(now, close)) {
+			if (++t->missed >= SCAN_TRACK_MISS_MAX) {
+				t->acquiring = true;
+				break;
+			}
+
+			scan_track_window(t, &open, &close);
+		}
+
+		if (t->acquiring) {
+			rx = true;
+		} else if (!TIMER_BEFORE(now, open)) {
+			rx = true;
+			if (!wake || TIMER_BEFORE(close, next))
+				next = close;
+			wake = true;
+		} else if (!wake || TIMER_BEFORE(open, next)) {
+			next = open;
+			wake = true;
+		}
+	}
+
+	if (ll_conn_in_event()) {
+		/* See scan_resume() */
+	} else if (rx && !scan_track_rx) {
+		radio_prepare(SCAN_TRACK_CH, LL_ACCESS_ADDRESS_ADV,
+							LL_CRCINIT_ADV);
+		radio_recv(0);
+	} else if (!rx && scan_track_rx) {
+		radio_stop();
+	}
+
+	scan_track_rx = rx;
+
+	/* Listening continuously while acquiring an advertiser */
+	timer_stop(t_ll_single_shot);
+
+	for (i = 0; i < scan_tracks_cnt; i++)
+		if (scan_tracks[i].acquiring)
+			return;
+
+	if (wake)
+		timer_start(t_ll_single_shot, TIMER_BEFORE(now, next) ?
+				next - now : 1, scan_track_update);
+}
+
+/* A PDU from a tracked advertiser: its events are anchored on it, and its
+ * interval is learned as the shortest time between two of them (advDelay is
+ * never negative). PDUs closer than the shortest advInterval belong to the
+ * same event and give no interval. */
+static void scan_track_recv(const struct ll_pdu_adv *pdu, bool crc,
+							uint32_t timestamp)
+{
+	struct scan_track *t;
+	uint32_t delta, events;
+	uint8_t i;
+
+	if (!crc || pdu->length < BDADDR_LEN)
+		return;
+
+	for (i = 0; i < scan_tracks_cnt; i++) {
+		t = &scan_tracks[i];
+
+		if (t->addr.type == pdu->tx_add && !memcmp(t->addr.addr,
+						pdu->payload, BDADDR_LEN))
+			break;
+	}
+
+	if (i == scan_tracks_cnt)
+		return;
+
+	delta = timestamp - t->last;
+
+	/* The first PDU after a reset gives no interval */
+	if (t->learn && t->last != 0 && delta >= LL_ADV_INTERVAL_MIN_CONN) {
+		if (t->interval == 0 || delta < t->interval / 2) {
+			t->interval = delta;
+		} else {
+			events = (delta + t->interval / 2) / t->interval;
+			if (delta / events < t->interval)
+				t->interval = delta / events;
+		}
+	}
+
+	t->last = timestamp ? timestamp : 1;
+	t->missed = 0;
+	t->acquiring = (t->interval == 0);
+
+	scan_track_update();
+}
+
+static void scan_radio_recv_cb(const uint8_t *pdu, bool crc, bool active)
+{
+	const struct ll_pdu_adv *rcvd_pdu = (const struct ll_pdu_adv*) pdu;
+	uint32_t timestamp = radio_get_end_time();
+
+	if (scan_tracking) {
+		scan_track_recv(rcvd_pdu, crc, timestamp);
+
+		/* The windows may be closed */
+		if (scan_track_rx)
+			radio_recv(0);
+
+		scan_report(pdu, crc, timestamp);
+		return;
+	}
+
+	if (scan_rsp_pending) {
+		/* Reception T_IFS after our SCAN_REQ */
+		scan_rsp_pending = false;
+		scan_backoff_update(is_scan_rsp_valid(rcvd_pdu, crc));
+	} else if (active && scan_req_prepare(rcvd_pdu, crc)) {
+		/* The radio sends the SCAN_REQ, then listens for the
+		 * SCAN_RSP */
+		scan_rsp_pending = true;
+		scan_report(pdu, crc, timestamp);
+		return;
+	}
+
+	/* Receive new packets while the radio is not explicitly stopped */
+	if (active)
+		radio_stop();
+
+	radio_recv(scan_radio_flags());
+
+	scan_report(pdu, crc, timestamp);
+}
+
+/**@brief Deliver the queued advertising reports to the application
+ *
+ * Called by the platform, in a lower priority context than the radio, after
+ * ll_plat_signal_adv_reports(). Consecutive reports are delivered in a single
+ * call to the batch callback, if any. Reports queued while delivering are
+ * handled before returning.
+ */
+void ll_adv_reports_deliver(void)
+{
+	uint8_t tail = adv_reports_tail;
+	uint8_t head = adv_reports_head;
+	uint8_t idx, n, i;
+
+	while (tail != head) {
+		__sync_synchronize();
+
+		/* Only the contiguous part, the rest on the next loop */
+		idx = ADV_REPORT_IDX(tail);
+		n = head - tail;
+		if (n > CONFIG_LL_ADV_REPORT_QUEUE - idx)
+			n = CONFIG_LL_ADV_REPORT_QUEUE - idx;
+
+		if (ll_adv_report_batch_cb)
+			ll_adv_report_batch_cb(&adv_reports[idx], n);
+		else if (ll_adv_report_cb)
+			for (i = 0; i < n; i++)
+				ll_adv_report_cb(&adv_reports[idx + i]);
+
+		for (i = 0; i < n; i++)
+			radio_release_buf(adv_reports[idx + i].data);
+
+		tail += n;
+		__sync_synchronize();
+		adv_reports_tail = tail;
+
+		head = adv_reports_head;
+	}
+
+	if (adv_table_due) {
+		adv_table_due = false;
+		ll_adv_table_deliver(adv_summary_cb);
+	}
+}
+
+/**@brief Deliver advertising reports in batches
+ *
+ * @param [in] cb: the function to call with consecutive reports, or NULL to
+ * 		deliver them one by one to the ll_scan_start() callback
+ *
+ * @return -EBUSY if scanning
+ */
+int16_t ll_set_adv_report_batch_cb(adv_report_batch_cb_t cb)
+{
+	if (current_state == LL_STATE_SCANNING)
+		return -EBUSY;
+
+	ll_adv_report_batch_cb = cb;
+
+	return 0;
+}
+
+/**@brief Report the PDUs received with a CRC error
+ *
+ * Their content is not reliable, but their RSSI may still be useful. They are
+ * dropped by default.
+ *
+ * @param [in] report: true to report them with crc_ok unset
+ *
+ * @return -EBUSY if scanning
+ */
+int16_t ll_set_scan_crc_errors(bool report)
+{
+	if (current_state == LL_STATE_SCANNING)
+		return -EBUSY;
+
+	scan_crc_errors = report;
+
+	return 0;
+}
+
+/**@brief Report only the PDUs matching at least one of the rules
+ *
+ * The rules are checked in the radio interrupt, before any other processing
+ * (duplicate filter, aggregation table) and before the reports are queued.
+ *
+ * @param [in] rules: array of rules, see struct ll_scan_filter_rule
+ * @param [in] n: number of rules, up to LL_FILTER_RULES_MAX. 0 to report
+ * 		every PDU
+ *
+ * @return -EBUSY if scanning
+ * @return -EINVAL if a rule is invalid
+ */
+int16_t ll_set_scan_filter(const struct ll_scan_filter_rule *rules, uint8_t n)
+{
+	if (current_state == LL_STATE_SCANNING)
+		return -EBUSY;
+
+	return ll_filter_set(rules, n);
+}
+
+/**@brief Filter duplicate advertising reports
+ *
+ * In a scan session, a device is only reported again if its data changed
+ * (LL_DUP_FILTER_ADDR_DATA) or if it was last reported more than max_age ago.
+ * The devices are forgotten when scanning starts.
+ *
+ * @param [in] mode: LL_DUP_FILTER_NONE, LL_DUP_FILTER_ADDR or
+ * 		LL_DUP_FILTER_ADDR_DATA
+ * @param [in] max_age: in us, 0 to report each device only once
+ *
+ * @return -EBUSY if scanning
+ * @return -EINVAL if mode is unknown
+ */
+int16_t ll_set_scan_dup_filter(uint8_t mode, uint32_t max_age)
+{
+	if (current_state == LL_STATE_SCANNING)
+		return -EBUSY;
+
+	return ll_dup_init(mode, max_age);
 }
 
-int16_t ll_set_advertising_data(const uint8_t *data, uint8_t len)
+/**@brief Aggregate the received PDUs per advertiser instead of reporting them
+ *
+ * When enabled, no advertising report is delivered: the application reads the
+ * table with ll_adv_table_read() or ll_adv_table_find(), or gets summaries of
+ * every advertiser each period. The table is cleared when enabled.
+ *
+ * @param [in] enable: true to aggregate the PDUs
+ * @param [in] period: in us, rounded up to a multiple of the scan interval.
+ * 		0 for no periodic summaries
+ * @param [in] cb: the function to call with the periodic summaries
+ *
+ * @return -EBUSY if scanning
+ * @return -EINVAL if period is set without a callback
+ */
+int16_t ll_set_adv_table(bool enable, uint32_t period, adv_summary_cb_t cb)
 {
-	if (current_state != LL_STATE_STANDBY)
+	if (current_state == LL_STATE_SCANNING)
 		return -EBUSY;
 
-	if (data == NULL)
+	if (enable && period && cb == NULL)
 		return -EINVAL;
 
-	if (len > LL_ADV_MTU_DATA)
-		return -EINVAL;
+	adv_table_enabled = enable;
+	adv_table_period = enable ? period : 0;
+	adv_summary_cb = cb;
 
-	memcpy(pdu_adv.payload + sizeof(laddr->addr), data, len);
-	pdu_adv.length = sizeof(laddr->addr) + len;
+	if (enable)
+		ll_adv_table_reset();
 
 	return 0;
 }
 
-int16_t ll_set_scan_response_data(const uint8_t *data, uint8_t len)
+/**@brief Share the scan time between the advertising channels by their quality
+ *
+ * Channels with more reports per window and fewer CRC errors get more scan
+ * windows, but each channel keeps at least CONFIG_LL_SCAN_CH_FLOOR % of them.
+ * Otherwise the channels are scanned in turn.
+ *
+ * @return -EBUSY if scanning
+ */
+int16_t ll_set_scan_adaptive(bool enable)
 {
-	if (data == NULL)
-		return -EINVAL;
-
-	if (len > LL_ADV_MTU_DATA)
-		return -EINVAL;
+	if (current_state == LL_STATE_SCANNING)
+		return -EBUSY;
 
-	memcpy(pdu_scan_rsp.payload + sizeof(laddr->addr), data, len);
-	pdu_scan_rsp.length = sizeof(laddr->addr) + len;
+	scan_adaptive = enable;
 
 	return 0;
 }
 
-static void init_adv_pdus(void)
+/**@brief Statistics of an advertising channel since scanning started
+ *
+ * @param [in] ch: 37, 38 or 39
+ *
+ * @return -EINVAL if ch is not an advertising channel
+ */
+int16_t ll_get_scan_ch_stats(uint8_t ch, struct ll_scan_ch_stats *stats)
 {
-	pdu_adv.tx_add = laddr->type;
-	memcpy(pdu_adv.payload, laddr->addr, sizeof(laddr->addr));
-
-	ll_set_advertising_data(NULL, 0);
+	if (ch < adv_chs[0] || ch >= adv_chs[0] + SCAN_CH_CNT
+							|| stats == NULL)
+		return -EINVAL;
 
-	pdu_scan_rsp.type = LL_PDU_SCAN_RSP;
-	pdu_scan_rsp.tx_add = laddr->type;
-	memcpy(pdu_scan_rsp.payload, laddr->addr, sizeof(laddr->addr));
+	*stats = scan_chs[ch - adv_chs[0]].stats;
 
-	ll_set_scan_response_data(NULL, 0);
+	return 0;
 }
 
-static void init_default_conn_params(void)
+/**@brief Radio dead time of continuous scanning (window == interval)
+ *
+ * The radio only stops listening to switch to the next channel, during its
+ * ramp-up. Switches deferred because a packet was being received are not
+ * counted: they happen when the radio is restarted anyway.
+ *
+ * @param [out] switches: number of channel switches since scanning started
+ * @param [out] dead_time: total time not listening in us
+ *
+ * @return -EINVAL if a parameter is NULL
+ */
+int16_t ll_get_scan_dead_time(uint32_t *switches, uint32_t *dead_time)
 {
-	ll_conn_params.conn_interval_min	= 16; /* 20 ms */
-	ll_conn_params.conn_interval_max 	= 160; /* 200 ms */
-	ll_conn_params.conn_latency 		= 0;
-	ll_conn_params.supervision_timeout	= 100; /* 1s */
-	ll_conn_params.minimum_ce_length	= 0;
-	ll_conn_params.maximum_ce_length	= 16; /* 10 ms */
+	if (switches == NULL || dead_time == NULL)
+		return -EINVAL;
 
-	ll_set_data_ch_map(LL_DATA_CH_ALL);
+	radio_get_switch_stats(switches, dead_time);
+	*switches -= scan_switches_base;
+	*dead_time -= scan_dead_time_base;
+
+	return 0;
 }
 
-/**@brief At the beginning of a new connection, prepare the CONNECT_REQ PDU to
- * send
- *
- * See Link Layer specification Section 4.5, Core 4.1 pages 2537-2547
+/**@brief Number of advertising reports dropped so far because they could not
+ * be queued, i.e. the application did not keep up with the received PDUs
  */
-static void init_connect_req_pdu()
+uint32_t ll_get_adv_report_overflow(void)
 {
-	struct ll_pdu_connect_payload *payload;
-
-	pdu_connect_req.type = LL_PDU_CONNECT_REQ;
-	pdu_connect_req.tx_add = laddr->type;
-	pdu_connect_req.length = sizeof(*payload);
-
-	payload = (struct ll_pdu_connect_payload*)(pdu_connect_req.payload);
-	memcpy(payload->init_add, laddr->addr, BDADDR_LEN);
+	return adv_reports_overflow;
+}
 
-	payload->aa = generate_access_address();
-	payload->crc_init = 0;
-	for (int i = 0; i < 3; i++)
-		payload->crc_init |= (random_generate() << (8*i));
+static void scan_singleshot_cb(void)
+{
+	scan_window_open = false;
 
-	/* Max. allowed value : min(10ms, connInterval-1.25ms) */
-	if (ll_conn_params.conn_interval_min > 8)
-		payload->win_size = 8;
-	else
-		payload->win_size = ll_conn_params.conn_interval_min-1;
+	if (!ll_conn_in_event())
+		radio_stop();
 
-	/* The interval timer is set to fire every conn_interval_min just
-	 * after the CONNECT_REQ PDU is sent. We set the offset to
-	 * conn_interval_min - 3 to keep a wide window almost centered on the
-	 * first timer event.
-	 */
-	payload->win_offset = ll_conn_params.conn_interval_min-3;
+	/* An interrupted SCAN_REQ/SCAN_RSP exchange is not a failure */
+	scan_rsp_pending = false;
+}
 
-	payload->interval = ll_conn_params.conn_interval_min;
-	payload->latency = ll_conn_params.conn_latency;
-	payload->timeout = ll_conn_params.supervision_timeout;
-	payload->ch_map = data_ch_map.mask;
+/* End of the window of a channel: update its averages and the shares */
+static void scan_ch_window_end(uint8_t idx)
+{
+	struct scan_ch *ch = &scan_chs[idx];
+	uint32_t score[SCAN_CH_CNT];
+	uint32_t total = 0;
+	uint16_t pdus = ch->win_pdus;
+	uint16_t errors = ch->win_errors;
+	uint16_t reports = ch->win_reports;
+	int32_t sample;
+	uint8_t i;
+
+	ch->win_pdus = 0;
+	ch->win_errors = 0;
+	ch->win_reports = 0;
+
+	ch->stats.windows++;
+	ch->stats.pdus += pdus;
+	ch->stats.crc_errors += errors;
+	ch->stats.reports += reports;
+
+	sample = (reports > 0xFF ? 0xFF : reports) << 8;
+	ch->yield += (sample - ch->yield) >> SCAN_CH_AVG_SHIFT;
+
+	if (pdus + errors > 0) {
+		sample = ((uint32_t) errors << 8) / (pdus + errors);
+		ch->errors += (sample - ch->errors) >> SCAN_CH_AVG_SHIFT;
+	}
 
-	/* "Random" value between 5 and 16 */
-	payload->hop = (random_generate() % 12) + 5;
-	payload->sca = 0; /* Worst accuracy : 251->500ppm */
+	for (i = 0; i < SCAN_CH_CNT; i++) {
+		score[i] = ((uint32_t) scan_chs[i].yield
+					* (256 - scan_chs[i].errors)) >> 8;
+		total += score[i];
+	}
 
+	for (i = 0; i < SCAN_CH_CNT; i++) {
+		if (total == 0)
+			scan_chs[i].stats.share = 100 / SCAN_CH_CNT;
+		else
+			scan_chs[i].stats.share = CONFIG_LL_SCAN_CH_FLOOR
+				+ ((100 - SCAN_CH_CNT * CONFIG_LL_SCAN_CH_FLOOR)
+				* score[i]) / total;
+	}
 }
 
-int16_t ll_init(const bdaddr_t *addr)
+/* Smooth weighted round robin: the channels are interleaved according to
+ * their shares */
+static uint8_t scan_ch_pick(void)
 {
-	int16_t err_code;
-
-	if (addr == NULL)
-		return -EINVAL;
+	int16_t total = 0;
+	uint8_t i, best = 0;
 
-	err_code = ll_plat_init();
-	if (err_code < 0)
-		return err_code;
+	for (i = 0; i < SCAN_CH_CNT; i++) {
+		scan_chs[i].credit += scan_chs[i].stats.share;
+		total += scan_chs[i].stats.share;
 
-	err_code = log_init();
-	if (err_code < 0 && err_code != -EALREADY)
-		return err_code;
+		if (scan_chs[i].credit > scan_chs[best].credit)
+			best = i;
+	}
 
-	err_code = timer_init();
-	if (err_code < 0)
-		return err_code;
+	scan_chs[best].credit -= total;
 
-	err_code = radio_init();
-	if (err_code < 0)
-		return err_code;
+	return best;
+}
 
-	err_code = random_init();
-	if (err_code < 0)
-		return err_code;
+static void scan_ch_reset(void)
+{
+	uint8_t i;
 
-	t_ll_interval = timer_create(TIMER_REPEATED);
-	if (t_ll_interval < 0)
-		return t_ll_interval;
+	memset(scan_chs, 0, sizeof(scan_chs));
 
-	t_ll_single_shot = timer_create(TIMER_SINGLESHOT);
-	if (t_ll_single_shot < 0)
-		return t_ll_single_shot;
+	for (i = 0; i < SCAN_CH_CNT; i++)
+		scan_chs[i].stats.share = 100 / SCAN_CH_CNT;
 
-	t_ll_ifs = timer_create(TIMER_SINGLESHOT);
-	if (t_ll_ifs < 0)
-		return t_ll_ifs;
+	scan_ch_window = false;
+}
 
-	laddr = addr;
-	current_state = LL_STATE_STANDBY;
+/* Channel of the next scan window */
+static void scan_next_ch(void)
+{
+	if (scan_adaptive) {
+		if (scan_ch_window)
+			scan_ch_window_end(adv_ch_idx);
 
-	init_adv_pdus();
-	init_default_conn_params();
+		scan_ch_window = true;
+		adv_ch_idx = scan_ch_pick();
+		return;
+	}
 
-	return 0;
+	if (inc_adv_ch_idx() < 0)
+		adv_ch_idx = first_adv_ch_idx();
 }
 
-static void scan_radio_recv_cb(const uint8_t *pdu, bool crc, bool active)
+static void scan_adv_table_check(void)
 {
-	struct ll_pdu_adv *rcvd_pdu = (struct ll_pdu_adv*) pdu;
+	uint32_t now;
 
-	/* Receive new packets while the radio is not explicitly stopped */
-	radio_recv(0);
+	if (adv_table_period) {
+		now = timer_get_timestamp();
 
-	if (!ll_adv_report_cb) {
-		ERROR("No adv. report callback defined");
-		return;
+		if (now - adv_table_last >= adv_table_period) {
+			adv_table_last = now;
+			adv_table_due = true;
+			ll_plat_signal_adv_reports();
+		}
 	}
+}
 
-	ll_adv_report = (struct adv_report) {
-		.type = rcvd_pdu->type,
-		.addr = { .type = rcvd_pdu->tx_add },
-		.data = rcvd_pdu->payload + BDADDR_LEN,
-		.len = rcvd_pdu->length - BDADDR_LEN
-	};
+static void scan_interval_cb(void)
+{
+	scan_adv_table_check();
+	scan_next_ch();
+	scan_window_open = true;
 
-	memcpy(ll_adv_report.addr.addr, rcvd_pdu->payload, BDADDR_LEN);
+	if (!ll_conn_in_event()) {
+		radio_prepare(adv_chs[adv_ch_idx], LL_ACCESS_ADDRESS_ADV,
+								LL_CRCINIT_ADV);
+		radio_recv(scan_radio_flags());
+	}
 
-	ll_plat_send_adv_report(ll_adv_report_cb, &ll_adv_report);
+	if (!scan_continuous)
+		timer_start(t_ll_single_shot, t_scan_window,
+							scan_singleshot_cb);
 }
 
-static void scan_singleshot_cb(void)
+static void scan_continuous_cb(void)
 {
-	radio_stop();
+	scan_adv_table_check();
+	scan_next_ch();
+
+	if (!ll_conn_in_event())
+		radio_switch_channel(adv_chs[adv_ch_idx]);
 }
 
-static void scan_interval_cb(void)
+static void scan_set_radio(void)
 {
-	if (!inc_adv_ch_idx())
-		adv_ch_idx = first_adv_ch_idx();
+	radio_set_callbacks(scan_radio_recv_cb, NULL);
+	radio_set_timeout_cb(scan_active ? scan_radio_timeout_cb : NULL);
+	radio_set_out_buffer((uint8_t *) &pdu_scan_req);
+}
 
-	radio_prepare(adv_chs[adv_ch_idx], LL_ACCESS_ADDRESS_ADV,
-								LL_CRCINIT_ADV);
-	radio_recv(0);
+/* End of a connection event during scanning */
+static void scan_resume(void)
+{
+	scan_set_radio();
+
+	if (scan_tracking) {
+		if (scan_track_rx) {
+			radio_prepare(SCAN_TRACK_CH, LL_ACCESS_ADDRESS_ADV,
+							LL_CRCINIT_ADV);
+			radio_recv(0);
+		}
+
+		return;
+	}
 
-	timer_start(t_ll_single_shot, t_scan_window, scan_singleshot_cb);
+	if (scan_window_open) {
+		radio_prepare(adv_chs[adv_ch_idx], LL_ACCESS_ADDRESS_ADV,
+								LL_CRCINIT_ADV);
+		radio_recv(scan_radio_flags());
+	}
 }
 
 /**@brief Set scan parameters and start scanning
@@ -560,14 +1926,16 @@ static void scan_interval_cb(void)
  * @note The HCI spec specifies interval in units of 0.625 ms.
  * 	Here we use us directly.
  *
- * @param [in] scan_type: should be LL_SCAN_ACTIVE or LL_SCAN_PASSIVE
- * 		(only the latter implemented at this time)
+ * @param [in] scan_type: should be LL_SCAN_ACTIVE or LL_SCAN_PASSIVE. When
+ * 		active, SCAN_RSPs are reported as well
  * @param [in] interval: the scan Interval in us
- * @param [in] window: the scan Window in us
+ * @param [in] window: the scan Window in us. If equal to interval, the radio
+ * 		listens continuously and is only switched to the next channel
+ * 		at each interval (see ll_get_scan_dead_time())
  * @param [in] adv_report_cb: the function to call for advertising report events
  *
  * @return -EINVAL if window > interval or interval > 10.24 s
- * @return -EINVAL if scan_type != LL_SCAN_PASSIVE
+ * @return -EINVAL if scan_type is unknown
  */
 int16_t ll_scan_start(uint8_t scan_type, uint32_t interval, uint32_t window,
 						adv_report_cb_t adv_report_cb)
@@ -579,22 +1947,42 @@ int16_t ll_scan_start(uint8_t scan_type, uint32_t interval, uint32_t window,
 
 	switch(scan_type) {
 		case LL_SCAN_PASSIVE:
-			/* Setup callback function */
-			ll_adv_report_cb = adv_report_cb;
+			scan_active = false;
 			break;
 
 		case LL_SCAN_ACTIVE:
-		/* Not implemented */
+			scan_active = true;
+			scan_backoff_reset();
+			break;
+
 		default:
 			return -EINVAL;
 	}
 
-	radio_set_callbacks(scan_radio_recv_cb, NULL);
+	/* Setup callback function */
+	ll_adv_report_cb = adv_report_cb;
+
+	/* A new scan session: report every device again */
+	ll_dup_reset();
+	adv_table_last = timer_get_timestamp();
+
+	/* Otherwise set at the end of the connection event */
+	if (!ll_conn_in_event())
+		scan_set_radio();
 
 	/* Setup timer and save window length */
 	t_scan_window = window;
+	scan_continuous = (window == interval);
+	scan_tracking = false;
+
+	/* Scanning uses every advertising channel */
+	adv_ch_map = LL_ADV_CH_ALL;
+	adv_ch_idx = ADV_CH_IDX_39;
+	scan_ch_reset();
+	radio_get_switch_stats(&scan_switches_base, &scan_dead_time_base);
 
-	err_code = timer_start(t_ll_interval, interval, scan_interval_cb);
+	err_code = timer_start(t_ll_interval, interval, scan_continuous ?
+				scan_continuous_cb : scan_interval_cb);
 	if (err_code < 0)
 		return err_code;
 
@@ -606,6 +1994,91 @@ int16_t ll_scan_start(uint8_t scan_type, uint32_t interval, uint32_t window,
 	return 0;
 }
 
+/**@brief Scan only around the advertising events of known advertisers
+ *
+ * Instead of periodic scan windows, the radio listens on channel 37 (the
+ * first channel of the advertising events) only when a PDU of a tracked
+ * advertiser is expected. The windows are widened with the clock drift and
+ * after missed events. An advertiser is listened for continuously until its
+ * first PDU, when its interval is being learned, and after several missed
+ * events. The received PDUs are reported as in passive scanning.
+ *
+ * @param [in] tags: the advertisers to track. An interval of 0 is learned
+ * 		from the received PDUs, otherwise it is advInterval in us
+ * @param [in] n: number of advertisers, up to CONFIG_LL_SCAN_TRACK_MAX
+ * @param [in] adv_report_cb: the function to call for advertising report events
+ *
+ * @return -EBUSY if not in standby (or connection) state
+ * @return -EINVAL if n is 0 or too large, or an interval too long
+ */
+int16_t ll_scan_track_start(const struct ll_scan_tag *tags, uint8_t n,
+						adv_report_cb_t adv_report_cb)
+{
+	int16_t err_code;
+	uint8_t i;
+
+	if (current_state != LL_STATE_STANDBY
+				&& current_state != LL_STATE_CONNECTION)
+		return -EBUSY;
+
+	if (tags == NULL || n == 0 || n > CONFIG_LL_SCAN_TRACK_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < n; i++)
+		if (tags[i].interval > LL_ADV_INTERVAL_MAX)
+			return -EINVAL;
+
+	memset(scan_tracks, 0, sizeof(scan_tracks));
+
+	for (i = 0; i < n; i++) {
+		scan_tracks[i].addr = tags[i].addr;
+		scan_tracks[i].interval = tags[i].interval;
+		scan_tracks[i].learn = (tags[i].interval == 0);
+		scan_tracks[i].acquiring = true;
+	}
+
+	scan_tracks_cnt = n;
+	scan_tracking = true;
+	scan_ch_reset();
+	scan_track_rx = false;
+	scan_continuous = false;
+	scan_active = false;
+	scan_rsp_pending = false;
+
+	ll_adv_report_cb = adv_report_cb;
+	ll_dup_reset();
+
+	radio_set_timeout_cb(NULL);
+	radio_set_callbacks(scan_radio_recv_cb, NULL);
+
+	err_code = timer_start(t_ll_interval, SCAN_TRACK_PERIOD,
+							scan_track_update);
+	if (err_code < 0)
+		return err_code;
+
+	current_state = LL_STATE_SCANNING;
+	scan_track_update();
+
+	DBG("tracking %u advertisers", n);
+
+	return 0;
+}
+
+/**@brief Get a tracked advertiser, with its learned interval
+ *
+ * @return -EINVAL if idx is not a tracked advertiser
+ */
+int16_t ll_scan_track_get(uint8_t idx, struct ll_scan_tag *tag)
+{
+	if (idx >= scan_tracks_cnt || tag == NULL)
+		return -EINVAL;
+
+	tag->addr = scan_tracks[idx].addr;
+	tag->interval = scan_tracks[idx].interval;
+
+	return 0;
+}
+
 /**@brief Stop scanning
  */
 int16_t ll_scan_stop(void)
@@ -619,14 +2092,16 @@ int16_t ll_scan_stop(void)
 	if (err_code < 0)
 		return err_code;
 
-	err_code = timer_stop(t_ll_single_shot);
-	if (err_code < 0)
-		return err_code;
+	scan_tracking = false;
+	scan_track_rx = false;
+
+	/* The single shot timer is not active between scan windows */
+	timer_stop(t_ll_single_shot);
 
 	/* Call the single shot cb to stop the radio */
 	scan_singleshot_cb();
 
-	current_state = LL_STATE_STANDBY;
+	current_state = idle_state();
 
 	DBG("");
 
@@ -661,53 +2136,63 @@ int16_t ll_set_conn_params(ll_conn_params_t* conn_params)
  * @param [in] ch_map: the new channel map ; every channel is represented by a bit
  * 	with the LSB being channel index 0 and the 36th bit data channel 36.
  * 	A 1 indicates that the channel is used.
+ *
+ * The established master connections move to the new map with the channel map
+ * update procedure.
+ *
+ * @return -EINVAL if less than two channels are used
  */
 int16_t ll_set_data_ch_map(uint64_t ch_map)
 {
-	/* Mask to avoid channel indexes > 36 */
-	ch_map &= LL_DATA_CH_ALL;
-
-	data_ch_map.mask = ch_map;
-	data_ch_map.cnt= 0;
-
-	/* Build remapping table (used indexes in acending order */
-	for (uint8_t i = 0; i < LL_DATA_CH_NB; i++) {
-		if (ch_map & (1ULL << i)) {
-			data_ch_map.used[data_ch_map.cnt] = i;
-			data_ch_map.cnt++;
-		}
-	}
+	/* Only the connection uses the remapping table, this one checks the
+	 * map the same way before it reaches a CONNECT_REQ */
+	struct ll_chsel cs = { .algo = LL_CHSEL_CSA2 };
 
-	if (data_ch_map.cnt < 2) {
-		ERROR("Invalid channel map : 0x%10x", ch_map);
+	if (ll_chsel_set_map(&cs, ch_map) < 0) {
+		ERROR("Invalid channel map : 0x%10llx", ch_map);
 		return -EINVAL;
 	}
 
+	data_ch_map.mask = cs.mask;
+	ll_conn_set_ch_map(cs.mask);
+
 	return 0;
 }
 
 static void init_radio_recv_cb(const uint8_t *pdu, bool crc, bool active)
 {
 	struct ll_pdu_adv *rcvd_pdu = (struct ll_pdu_adv*) pdu;
+	struct ll_pdu_connect_payload *payload;
 
 	/* Answer to ADV_IND (connectable undirected advertising event) and
 	 * ADV_DIRECT_IND (connectable directed advertising event) PDUs from
-	 * accepted addresses with a CONNECT_REQ PDU */
+	 * accepted addresses with a CONNECT_REQ PDU. It is sent by the radio
+	 * T_IFS after the received PDU, so it is completed here during the
+	 * radio ramp-up, or cancelled.
+	 */
 
 	/* See Link Layer specification Section 2.3, Core 4.1 page 2505 */
-	if ( (rcvd_pdu->type == LL_PDU_ADV_IND &&
+	if (crc && ((rcvd_pdu->type == LL_PDU_ADV_IND &&
 			is_addr_accepted(rcvd_pdu->tx_add, rcvd_pdu->payload))
 		|| (rcvd_pdu->type == LL_PDU_ADV_DIRECT_IND &&
 			is_addr_accepted(rcvd_pdu->tx_add, rcvd_pdu->payload) &&
 			is_addr_mine(rcvd_pdu->rx_add,
-					rcvd_pdu->payload+BDADDR_LEN)) ) {
+					rcvd_pdu->payload+BDADDR_LEN))) ) {
 		/* Complete CONNECT_REQ PDU with the advertiser's address */
 		pdu_connect_req.rx_add = rcvd_pdu->tx_add;
+		pdu_connect_req.ch_sel = CONFIG_LL_CSA2 && rcvd_pdu->ch_sel;
 		memcpy(pdu_connect_req.payload+BDADDR_LEN, rcvd_pdu->payload,
 								BDADDR_LEN);
 
-		/* TODO go to CONNECTION_MASTER state
-		TODO notify application (cb function) */
+		/* ... and the transmit window at the planned position */
+		payload = (struct ll_pdu_connect_payload *)
+						pdu_connect_req.payload;
+		payload->win_offset = ll_conn_plan_offset(
+						timer_get_timestamp());
+
+		/* The end of the scan window must not cancel it */
+		init_connecting = true;
+		timer_stop(t_ll_single_shot);
 	}
 	else {
 		radio_stop();
@@ -715,25 +2200,75 @@ static void init_radio_recv_cb(const uint8_t *pdu, bool crc, bool active)
 	}
 }
 
+/* Link Layer specification Section 4.4.4, Core 4.1 page 2537
+ * The CONNECT_REQ PDU was sent: enter the Connection state as master. The
+ * connection timer is started before the initiating timer is stopped, to keep
+ * the timestamps running.
+ */
+static void init_radio_send_cb(bool active)
+{
+	struct ll_pdu_connect_payload *payload;
+	int16_t err_code;
+
+	payload = (struct ll_pdu_connect_payload *) pdu_connect_req.payload;
+	err_code = ll_conn_master_start(payload, pdu_connect_req.rx_add,
+			radio_get_end_time(), pdu_connect_req.ch_sel);
+
+	timer_stop(t_ll_interval);
+	init_connecting = false;
+
+	scan_window_open = false;
+	current_state = (err_code < 0) ? idle_state() : LL_STATE_CONNECTION;
+}
+
 static void init_singleshot_cb(void)
 {
-	radio_stop();
+	scan_window_open = false;
+
+	if (!ll_conn_in_event())
+		radio_stop();
 }
 
 static void init_interval_cb(void)
 {
-	if (!inc_adv_ch_idx())
+	if (init_connecting)
+		return;
+
+	if (inc_adv_ch_idx() < 0)
 		adv_ch_idx = first_adv_ch_idx();
 
-	radio_prepare(adv_chs[adv_ch_idx], LL_ACCESS_ADDRESS_ADV,
+	scan_window_open = true;
+
+	if (!ll_conn_in_event()) {
+		radio_prepare(adv_chs[adv_ch_idx], LL_ACCESS_ADDRESS_ADV,
 								LL_CRCINIT_ADV);
 
-	radio_recv(RADIO_FLAGS_TX_NEXT);
-	radio_set_out_buffer((uint8_t*)&pdu_connect_req);
+		radio_recv(RADIO_FLAGS_TX_NEXT);
+		radio_set_out_buffer((uint8_t*)&pdu_connect_req);
+	}
 
 	timer_start(t_ll_single_shot, t_scan_window, init_singleshot_cb);
 }
 
+static void init_set_radio(void)
+{
+	radio_set_callbacks(init_radio_recv_cb, init_radio_send_cb);
+	radio_set_timeout_cb(NULL);
+	radio_set_out_buffer((uint8_t *) &pdu_connect_req);
+}
+
+/* End of a connection event during initiating */
+static void init_resume(void)
+{
+	init_set_radio();
+
+	if (scan_window_open) {
+		radio_prepare(adv_chs[adv_ch_idx], LL_ACCESS_ADDRESS_ADV,
+								LL_CRCINIT_ADV);
+		radio_recv(RADIO_FLAGS_TX_NEXT);
+	}
+}
+
 /**@brief Try to establish a connection with the specified peer
  *
  * @param [in] interval: the scanning interval in us (2.5ms -> 10.24s)
@@ -747,7 +2282,8 @@ int16_t ll_conn_create(uint32_t interval, uint32_t window,
 {
 	int16_t err_code;
 
-	if (current_state != LL_STATE_STANDBY)
+	if (current_state != LL_STATE_STANDBY
+				&& current_state != LL_STATE_CONNECTION)
 		return -ENOREADY;
 
 	if (window > interval) {
@@ -766,10 +2302,15 @@ int16_t ll_conn_create(uint32_t interval, uint32_t window,
 	/* Generate new connection parameters and init CONNECT_REQ PDU */
 	init_connect_req_pdu();
 
-	radio_set_callbacks(init_radio_recv_cb, NULL);
+	/* Otherwise set at the end of the connection event */
+	if (!ll_conn_in_event())
+		init_set_radio();
 
 	/* Initiating state :
 	 * see Link Layer specification Section 4.4.4, Core v4.1 p.2537 */
+	adv_ch_map = LL_ADV_CH_ALL;
+	adv_ch_idx = ADV_CH_IDX_39;
+	init_connecting = false;
 	t_scan_window = window;
 	err_code = timer_start(t_ll_interval, interval, init_interval_cb);
 	if (err_code < 0)
@@ -790,13 +2331,16 @@ int16_t ll_conn_cancel(void)
 	if (current_state != LL_STATE_INITIATING)
 		return -ENOREADY;
 
+	/* The CONNECT_REQ PDU is being sent */
+	if (init_connecting)
+		return -EBUSY;
+
 	timer_stop(t_ll_interval);
 	timer_stop(t_ll_single_shot);
-	timer_stop(t_ll_ifs);
 
-	radio_stop();
+	init_singleshot_cb();
 
-	current_state = LL_STATE_STANDBY;
+	current_state = idle_state();
 
 	DBG("");
 
@@ -38,6 +38,10 @@
 /* Link Layer specification Section 2.3.1, Core 4.1 page 2506 */
 #define LL_ADV_MTU_DATA			(LL_ADV_MTU_PAYLOAD - BDADDR_LEN)
 
+/* Link Layer specification Section 2.4, Core 4.1 page 2511
+ * Payload of data channel PDUs (unencrypted) */
+#define LL_DATA_MTU_PAYLOAD		27
+
 /* Link Layer specification Section 4.4.2.2, Core 4.1 page 2528 */
 #define LL_ADV_INTERVAL_MIN_CONN	20000		/* 20 ms */
 #define LL_ADV_INTERVAL_MIN_NONCONN	100000		/* 100 ms */
@@ -45,6 +49,11 @@
 #define LL_ADV_INTERVAL_MAX		10240000	/* 10.24 s */
 #define LL_ADV_INTERVAL_QUANTUM		625		/* 0.625 ms */
 
+/* Link Layer specification Section 4.4.2.4.2, Core 4.1 page 2531
+ * Interval value to be passed to ll_advertise_start() to select high duty
+ * cycle directed advertising (the interval is set by the Link Layer). */
+#define LL_ADV_INTERVAL_DIRECT_HIGH	0
+
 /* Link Layer specification Section 4.4.3, Core 4.1 page 2535 */
 #define LL_SCAN_WINDOW_MAX		10240000	/* 10.24 s */
 #define LL_SCAN_INTERVAL_MAX		10240000	/* 10.24 s */
@@ -56,6 +65,17 @@
 #define LL_ADV_CH_ALL			(LL_ADV_CH_37 | LL_ADV_CH_38 |	\
  							LL_ADV_CH_39)
 
+/* Adaptive advertising interval schedule */
+#define LL_ADV_SCHED_STEPS_MAX		4
+#define LL_ADV_SCHED_BOOST_SCAN_REQ	(1 << 0) /* Restart on SCAN_REQ */
+
+/* HCI Funcional Specification Section 7.8.5, Core 4.1 page 1248 */
+#define LL_ADV_FILTER_NONE		0x00	/* Requests from any device */
+#define LL_ADV_FILTER_SCAN		0x01	/* SCAN_REQ from white list */
+#define LL_ADV_FILTER_CONN		0x02	/* CONNECT_REQ from white list */
+#define LL_ADV_FILTER_BOTH		(LL_ADV_FILTER_SCAN |		\
+							LL_ADV_FILTER_CONN)
+
 /* Link Layer specification Section 1.4, Core 4.1 page 2501 */
 #define LL_DATA_CH_ALL			0x1FFFFFFFFFULL
 
@@ -63,6 +83,11 @@
 #define LL_SCAN_PASSIVE			0x00
 #define LL_SCAN_ACTIVE			0x01
 
+/* Duplicate advertising reports filtering, see ll_set_scan_dup_filter() */
+#define LL_DUP_FILTER_NONE		0x00	/* Report every PDU */
+#define LL_DUP_FILTER_ADDR		0x01	/* Same address and PDU type */
+#define LL_DUP_FILTER_ADDR_DATA		0x02	/* Same address and data */
+
 /* Link Layer specification Section 2.3, Core 4.1 page 2505 */
 typedef enum ll_pdu {
 	LL_PDU_ADV_IND,
@@ -96,32 +121,205 @@ struct adv_report {
 	bdaddr_t	addr;
 	const uint8_t 	*data;
 	uint8_t		len;
+	int8_t		rssi;		/* dBm */
+	uint8_t		channel;	/* advertising channel: 37, 38 or 39 */
+	bool		crc_ok;
+	uint32_t	timestamp;	/* us, end of the PDU (timer clock,
+					 * captured by the radio) */
+};
+
+/* Advertiser aggregated by the scanner (see ll_set_adv_table()) */
+#define LL_RSSI_UNKNOWN			127
+
+struct ll_adv_summary {
+	bdaddr_t	addr;
+	ll_pdu_t	type;		/* of the last PDU */
+	uint8_t		data[LL_ADV_MTU_DATA];	/* of the last PDU */
+	uint8_t		len;
+	int8_t		rssi[3];	/* dBm average on channels 37 to 39,
+					 * or LL_RSSI_UNKNOWN */
+	uint32_t	count;		/* PDUs received */
+	uint32_t	first_seen;	/* us (timer clock) */
+	uint32_t	last_seen;	/* us (timer clock) */
+	uint32_t	interval;	/* observed advertising interval in us,
+					 * 0 if unknown */
+};
+
+/* Step of an adaptive advertising interval schedule */
+struct ll_adv_sched_step {
+	uint32_t	interval;	/* advertising interval in us */
+	uint32_t	duration;	/* in us, 0 for forever */
+};
+
+/* Early advertising report filter rule (see ll_set_scan_filter()). The fields
+ * member selects the conditions, all of which must be met. */
+#define LL_FILTER_RULES_MAX		8
+#define LL_FILTER_MFR_PREFIX_MAX	8
+
+#define LL_FILTER_ADDR			(1 << 0) /* Address prefix */
+#define LL_FILTER_AD_TYPE		(1 << 1) /* AD type present */
+#define LL_FILTER_UUID16		(1 << 2) /* 16-bit service UUID */
+#define LL_FILTER_UUID128		(1 << 3) /* 128-bit service UUID */
+#define LL_FILTER_MFR			(1 << 4) /* Manufacturer specific data */
+#define LL_FILTER_RSSI			(1 << 5) /* Minimum RSSI */
+
+#define LL_FILTER_PDU(type)		(1 << (type))
+
+struct ll_scan_filter_rule {
+	uint8_t		fields;		/* LL_FILTER_* */
+	uint8_t		pdu_types;	/* LL_FILTER_PDU() mask, 0 for any */
+	uint8_t		addr_prefix[BDADDR_LEN]; /* most significant first */
+	uint8_t		addr_prefix_len;
+	uint8_t		ad_type;
+	uint16_t	uuid16;
+	uint8_t		uuid128[16];	/* least significant first */
+	uint16_t	company_id;
+	uint8_t		mfr_prefix[LL_FILTER_MFR_PREFIX_MAX]; /* data after
+							       * company_id */
+	uint8_t		mfr_prefix_len;
+	int8_t		rssi_min;	/* dBm */
+};
+
+/* Statistics of an advertising channel (scanning) */
+struct ll_scan_ch_stats {
+	uint32_t	pdus;		/* received with a valid CRC */
+	uint32_t	crc_errors;	/* received with a CRC error */
+	uint32_t	reports;	/* reported (after the filters) */
+	uint32_t	windows;	/* scan windows */
+	uint8_t		share;		/* % of the scan windows */
+};
+
+/* Connection roles */
+#define LL_CONN_ROLE_MASTER		0
+#define LL_CONN_ROLE_SLAVE		1
+
+/* Connection events (see ll_set_conn_evt_cb()) */
+#define LL_CONN_EVT_CONNECTED		0
+#define LL_CONN_EVT_DISCONNECTED	1
+#define LL_CONN_EVT_DATA		2	/* see ll_conn_recv() */
+#define LL_CONN_EVT_UPDATED		3	/* new connection parameters */
+
+/* Disconnection reasons: HCI error codes, see Core 4.1 Vol 2 Part D */
+#define LL_CONN_REASON_TIMEOUT		0x08
+#define LL_CONN_REASON_INVALID_PARAMS	0x1E	/* invalid LL parameters */
+#define LL_CONN_REASON_INSTANT		0x28	/* instant passed */
+#define LL_CONN_REASON_FAILED		0x3E	/* never established */
+
+struct ll_conn_evt {
+	uint8_t		type;		/* LL_CONN_EVT_* */
+	uint8_t		handle;
+	uint8_t		role;		/* LL_CONN_ROLE_* */
+	uint8_t		reason;		/* LL_CONN_EVT_DISCONNECTED only */
+	bdaddr_t	peer;
+	uint16_t	interval;	/* connInterval (*1.25ms) */
+	uint16_t	latency;	/* connSlaveLatency */
+	uint16_t	timeout;	/* connSupervisionTimeout (*10ms) */
+};
+
+/* Data PDUs LLID: Link Layer specification Section 2.4, Core 4.1 page 2512 */
+#define LL_LLID_CONT			0x01	/* continuation fragment */
+#define LL_LLID_START			0x02	/* start of an L2CAP message */
+#define LL_LLID_CTRL			0x03	/* LL control PDU */
+
+/* Data PDU buffer pools (see ll_get_pool_stats()) */
+#define LL_POOL_TX			0
+#define LL_POOL_RX			1
+
+struct ll_pool_stats {
+	uint8_t		size;		/* number of buffers */
+	uint8_t		used;
+	uint8_t		used_max;	/* high-water mark */
+};
+
+/* Advertiser followed by predictive scanning (see ll_scan_track_start()) */
+struct ll_scan_tag {
+	bdaddr_t	addr;
+	uint32_t	interval;	/* advInterval in us, 0 to learn it */
 };
 
 /* Callback function for LE advertising reports (scanning mode)
  * See HCI Funcional Specification Section 7.7.65.2, Core 4.1 page 1220 */
 typedef void (*adv_report_cb_t)(struct adv_report *report);
 
+/* Callback function to deliver advertising reports in batches (scanning mode).
+ * The reports array holds n consecutive reports, which are only valid until
+ * the callback returns. When set, it takes precedence over adv_report_cb_t. */
+typedef void (*adv_report_batch_cb_t)(struct adv_report *reports, uint8_t n);
+
+/* Callback function for the periodic summaries of the aggregated advertisers.
+ * The summaries array holds n summaries; it is called until every advertiser
+ * in the table is delivered. */
+typedef void (*adv_summary_cb_t)(const struct ll_adv_summary *summaries,
+								uint8_t n);
+
+/* Callback function to refresh the advertising data right before the first PDU
+ * of every advertising event (advertising mode). The data is written in place
+ * into the outgoing PDU: data points to the AdvData field, which can hold up to
+ * LL_ADV_MTU_DATA octets, and len is its current length. Returns the new
+ * length. It is called from interrupt context, so it must be short. */
+typedef uint8_t (*adv_data_cb_t)(uint8_t *data, uint8_t len);
+
+/* Callback function for connections creation and termination, and for the
+ * data received. It is called from interrupt context. */
+typedef void (*conn_evt_cb_t)(const struct ll_conn_evt *evt);
+
 int16_t ll_init(const bdaddr_t *addr);
 
 /* Advertising */
 int16_t ll_set_advertising_data(const uint8_t *data, uint8_t len);
 int16_t ll_set_scan_response_data(const uint8_t *data, uint8_t len);
+int16_t ll_set_advertising_data_cb(adv_data_cb_t adv_data_cb);
+int16_t ll_set_direct_address(const bdaddr_t *addr);
+int16_t ll_set_adv_filter_policy(uint8_t policy);
 int16_t ll_advertise_start(ll_pdu_t type, uint32_t interval, uint8_t chmap);
 int16_t ll_advertise_stop(void);
+int16_t ll_set_advertising_interval(uint32_t interval);
+int16_t ll_set_advertising_schedule(const struct ll_adv_sched_step *steps,
+						uint8_t nsteps, uint8_t flags);
+int16_t ll_advertise_boost(void);
+
+/* White list */
+int16_t ll_white_list_add(const bdaddr_t *addr);
+int16_t ll_white_list_remove(const bdaddr_t *addr);
+int16_t ll_white_list_clear(void);
 
 /* Scanning */
 int16_t ll_scan_start(uint8_t scan_type, uint32_t interval, uint32_t window,
 						adv_report_cb_t adv_report_cb);
 int16_t ll_scan_stop(void);
+int16_t ll_scan_track_start(const struct ll_scan_tag *tags, uint8_t n,
+						adv_report_cb_t adv_report_cb);
+int16_t ll_scan_track_get(uint8_t idx, struct ll_scan_tag *tag);
+int16_t ll_set_adv_report_batch_cb(adv_report_batch_cb_t cb);
+int16_t ll_set_scan_crc_errors(bool report);
+int16_t ll_set_scan_dup_filter(uint8_t mode, uint32_t max_age);
+int16_t ll_set_scan_filter(const struct ll_scan_filter_rule *rules,
+								uint8_t n);
+int16_t ll_get_scan_dead_time(uint32_t *switches, uint32_t *dead_time);
+int16_t ll_set_scan_adaptive(bool enable);
+int16_t ll_get_scan_ch_stats(uint8_t ch, struct ll_scan_ch_stats *stats);
+int16_t ll_set_adv_table(bool enable, uint32_t period, adv_summary_cb_t cb);
+int16_t ll_adv_table_read(uint16_t *cursor, struct ll_adv_summary *summaries,
+								uint8_t max);
+int16_t ll_adv_table_find(const bdaddr_t *addr, struct ll_adv_summary *summary);
+uint32_t ll_get_adv_report_overflow(void);
 
 /* Initiating a connection */
 int16_t ll_set_conn_params(ll_conn_params_t* conn_params);
 int16_t ll_set_data_ch_map(uint64_t ch_map);
+int16_t ll_set_data_ch_adaptive(bool enable);
 int16_t ll_conn_create(uint32_t interval, uint32_t window,
 			bdaddr_t* peer_addresses, uint16_t num_addresses);
 int16_t ll_conn_cancel(void);
 
+/* Connection state */
+int16_t ll_set_conn_evt_cb(conn_evt_cb_t cb);
+int16_t ll_conn_send(uint8_t handle, uint8_t llid, const uint8_t *data,
+								uint8_t len);
+int16_t ll_conn_recv(uint8_t handle, uint8_t *llid, uint8_t *data);
+int16_t ll_get_pool_stats(uint8_t pool, struct ll_pool_stats *stats);
+
 /* LL "platform" interface */
 int16_t ll_plat_init(void);
-int16_t ll_plat_send_adv_report(adv_report_cb_t cb, struct adv_report *rpt);
+int16_t ll_plat_signal_adv_reports(void);
+void ll_adv_reports_deliver(void);
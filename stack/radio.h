@@ -28,9 +28,35 @@
 #define RADIO_MAX_PDU			39
 #define RADIO_MIN_PDU			2
 
+/* Time from radio_send() or radio_recv() until the radio starts to transmit or
+ * to listen, in us (nRF51822 Product Specification v2.0, tTXEN and tRXEN) */
+#define RADIO_RAMP_UP			140
+
+/* RADIO_FLAGS_RX_NEXT turns the radio around to RX T_IFS after a transmission.
+ * The reception is stopped by hardware if no packet starts within T_IFS, and
+ * the timeout callback is called. When combined with RADIO_FLAGS_TX_NEXT, the
+ * out buffer is sent T_IFS after the received packet (TX -> RX -> TX). The
+ * receive callback can still cancel this transmission with radio_stop(), since
+ * nothing is transmitted before the radio ramp-up is completed.
+ *
+ * Both flags can also be given to radio_recv(): the out buffer is sent T_IFS
+ * after the received packet, and the radio listens T_IFS after it, with the
+ * same timeout (RX -> TX -> RX).
+ */
 #define RADIO_FLAGS_RX_NEXT		1
 #define RADIO_FLAGS_TX_NEXT		2
 
+/* RADIO_FLAGS_DEV_MATCH drops by hardware the received packets whose first
+ * payload field (e.g. ScanA or InitA) is not in the device address match list.
+ * With RADIO_FLAGS_TX_NEXT, the next transmission is only chained when the
+ * address matches. A dropped packet ends the reception, as the timeout does:
+ * the timeout callback is called.
+ */
+#define RADIO_FLAGS_DEV_MATCH		4
+
+/* Size of the device address match list */
+#define RADIO_DEV_MATCH_MAX		8
+
 typedef enum radio_power {
 	RADIO_POWER_4_DBM,
 	RADIO_POWER_0_DBM,
@@ -45,17 +71,73 @@ typedef enum radio_power {
 /* The active parameter informs if the radio is currently active (e.g. because
  * of a TX/RX_NEXT flag). So, if the callback implementation wants to operate
  * the radio, it will need to first stop the radio.
+ *
+ * The pdu buffer is not used by next receptions, so the callback can restart
+ * the radio before processing it. It is reused after the callback returns,
+ * unless the callback keeps it with radio_hold_buf() (no copy is needed to
+ * pass it to upper layers). A held buffer is given back with
+ * radio_release_buf(). radio_hold_buf() fails with -ENOMEM when every buffer
+ * of the ring is held: the PDU must then be processed in the callback, before
+ * restarting the radio.
  */
 typedef void (*radio_recv_cb_t) (const uint8_t *pdu, bool crc, bool active);
 typedef void (*radio_send_cb_t) (bool active);
+typedef void (*radio_timeout_cb_t) (void);
 
 int16_t radio_init(void);
 
 int16_t radio_set_callbacks(radio_recv_cb_t recv_cb, radio_send_cb_t send_cb);
+int16_t radio_set_timeout_cb(radio_timeout_cb_t timeout_cb);
 int16_t radio_prepare(uint8_t ch, uint32_t aa, uint32_t crcinit);
 int16_t radio_recv(uint32_t flags);
 int16_t radio_send(const uint8_t *data, uint32_t flags);
 int16_t radio_stop(void);
 
+/* Called from the receive callback while the transmission of the out buffer is
+ * chained (active), it chains what follows the transmission, as if the flags
+ * were given to radio_recv(): RADIO_FLAGS_RX_NEXT listens T_IFS after it, and
+ * with RADIO_FLAGS_TX_NEXT too, the out buffer is sent again after the received
+ * packet. So the packets can be exchanged back-to-back (RX -> TX -> RX -> ...).
+ */
+int16_t radio_set_next(uint32_t flags);
+
+/* The next radio_recv() listens at most us, including the radio ramp-up, for
+ * the start of a packet. Then, the reception is stopped by hardware and the
+ * timeout callback is called, as with RADIO_FLAGS_RX_NEXT.
+ */
+int16_t radio_set_rx_window(uint32_t us);
+
+/* Move the current reception to another channel with minimum dead time. When a
+ * packet is being received (or sent, or waited for T_IFS after a transmission)
+ * the switch is deferred to the next radio_recv(). The number of switches done
+ * during a reception and their total dead time in us are counted.
+ */
+int16_t radio_switch_channel(uint8_t ch);
+void radio_get_switch_stats(uint32_t *switches, uint32_t *dead_time);
+
+/* Channel of the last received packet. It is valid in the receive callback */
+uint8_t radio_get_rx_channel(void);
+
 int16_t radio_set_tx_power(radio_power_t power);
+
+/* Buffer sent by the chained transmissions. From the receive callback, it also
+ * replaces the buffer of the transmission being chained. */
 void radio_set_out_buffer(uint8_t *buf);
+
+int16_t radio_set_dev_match(uint8_t idx, const uint8_t *addr, uint8_t type);
+int16_t radio_clear_dev_match(void);
+bool radio_dev_matched(void);
+
+/* RSSI of the last received packet in dBm. It is valid in the receive callback
+ */
+int8_t radio_get_rssi(void);
+
+/* Timestamps (see timer_get_timestamp()) of the end of the Access Address and
+ * of the end of the last packet, received or sent. They are captured by the
+ * hardware, and valid in the receive and send callbacks.
+ */
+uint32_t radio_get_address_time(void);
+uint32_t radio_get_end_time(void);
+
+int16_t radio_hold_buf(const uint8_t *pdu);
+int16_t radio_release_buf(const uint8_t *ptr);
@@ -30,10 +30,15 @@
 #define TIMER_MILLIS(v)			(v * 1000UL)	/* ms -> us */
 #define TIMER_SECONDS(v)		(v * 1000000UL)	/* s -> us */
 
+/* Timestamps comparison, valid while they are less than ~35 minutes apart */
+#define TIMER_BEFORE(a, b)		((int32_t) ((a) - (b)) < 0)
+
 typedef void (*timer_cb_t) (void);
 
 int16_t timer_init(void);
 int16_t timer_create(uint8_t type);
 int16_t timer_start(int16_t id, uint32_t us, timer_cb_t cb);
+int16_t timer_start_at(int16_t id, uint32_t timestamp, timer_cb_t cb);
 int16_t timer_stop(int16_t id);
 uint32_t timer_get_remaining_us(int16_t id);
+uint32_t timer_get_timestamp(void);